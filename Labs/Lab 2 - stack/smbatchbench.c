@@ -0,0 +1,184 @@
+/**
+ * @file smbatchbench.c
+ *
+ * @brief Runs the same program over a million rows with sm_run_batch and
+ *        with sm_run one row at a time, and checks that they agree: every
+ *        row sm_run fails on (dividing by zero, or INT_MIN by -1) must be
+ *        marked failed in its lane, and every other lane must hold the
+ *        value sm_run left on top.  Reports the rows per second of both.
+ *        The batch kernels only vectorize with optimization, so make builds
+ *        this at -O3 (make smbatchbench, or make bench).
+ */
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "smvm.h"
+
+#define ROWS (1 << 20)
+#define LANES 1024
+
+// The rows start with the extra value at the bottom, then the divisor, then
+// the dividend on top, so the first div can fail depending on the row
+static const char *source = "div          # dividend / divisor\n"
+                            "push 7\n"
+                            "add\n"
+                            "rotate 2\n"
+                            "sub          # extra - (quotient + 7)\n"
+                            "push 2\n"
+                            "rotate 2\n"
+                            "div          # never fails\n"
+                            "push 3\n"
+                            "mult         # halved first, so it cannot overflow\n";
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Fill the input columns with random rows, mixing in rows that divide
+ *        by zero, rows that divide INT_MIN by -1 and rows that divide INT_MIN
+ *        by a divisor that works
+ * @param extras - the bottom value of each row
+ * @param divisors - the divisor of each row
+ * @param dividends - the dividend of each row
+ */
+static void fill_rows(int *extras, int *divisors, int *dividends)
+{
+    srand(1);
+    for (int i = 0; i < ROWS; i++)
+    {
+        extras[i] = rand() % 2000 - 1000;
+        divisors[i] = rand() % 50 - 25;
+        dividends[i] = rand() - RAND_MAX / 2;
+        if (i % 7 == 3)
+        {
+            divisors[i] = 0;
+        }
+        else if (i % 11 == 5)
+        {
+            dividends[i] = INT_MIN;
+            divisors[i] = -1;
+        }
+        else if (i % 13 == 6)
+        {
+            dividends[i] = INT_MIN;
+            divisors[i] = 2;
+        }
+    }
+}
+
+/**
+ * @brief Program entry procedure
+ * @return 0 if both ways of running the rows agreed, 1 otherwise
+ */
+int main(void)
+{
+    struct sm_program_t program;
+    int error_line;
+    int failed_at;
+    sm_program_init(&program);
+    if (sm_assemble(&program, source, &error_line) != 0 || sm_verify(&program, 3, &failed_at) != 0)
+    {
+        fprintf(stderr, "could not build the program\n");
+        return 1;
+    }
+
+    int *extras = (int *)malloc(ROWS * sizeof(int));
+    int *divisors = (int *)malloc(ROWS * sizeof(int));
+    int *dividends = (int *)malloc(ROWS * sizeof(int));
+    int *expected = (int *)malloc(ROWS * sizeof(int));
+    unsigned char *row_failed = (unsigned char *)malloc(ROWS);
+    int *results = (int *)malloc(LANES * sizeof(int));
+    struct stackm_batch_t batch;
+    if (extras == NULL || divisors == NULL || dividends == NULL || expected == NULL || row_failed == NULL ||
+        results == NULL || sm_batch_init(&batch, LANES) != 0)
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    fill_rows(extras, divisors, dividends);
+
+    // One row at a time, the reference
+    struct stackm_t stack;
+    sm_init(&stack);
+    int failed_rows = 0;
+    double start = now();
+    for (int i = 0; i < ROWS; i++)
+    {
+        sm_push(&stack, extras[i]);
+        sm_push(&stack, divisors[i]);
+        sm_push(&stack, dividends[i]);
+        row_failed[i] = (unsigned char)(sm_run(&stack, &program, &failed_at) != 0);
+        if (row_failed[i])
+        {
+            if (program.code[failed_at] != SM_OP_DIV)
+            {
+                fprintf(stderr, "row %d failed on something other than div\n", i);
+                return 1;
+            }
+            failed_rows++;
+        }
+        else
+        {
+            expected[i] = stack.values[stack.size - 1]; // sm_top would print
+        }
+        while (sm_pop(&stack) == 0)
+        {
+            // Leave the stack empty, with its array kept, for the next row
+        }
+    }
+    double row_time = now() - start;
+
+    // The whole batch at a time
+    start = now();
+    for (int first = 0; first < ROWS; first += LANES)
+    {
+        sm_batch_reset(&batch);
+        sm_batch_push(&batch, extras + first);
+        sm_batch_push(&batch, divisors + first);
+        sm_batch_push(&batch, dividends + first);
+        if (sm_run_batch(&batch, &program, &failed_at) != 0 || sm_batch_top(&batch, results) != 0)
+        {
+            fprintf(stderr, "batch at row %d stopped at offset %d\n", first, failed_at);
+            return 1;
+        }
+
+        for (int lane = 0; lane < LANES; lane++)
+        {
+            int row = first + lane;
+            if (batch.failed[lane] != row_failed[row])
+            {
+                fprintf(stderr, "row %d: sm_run %s but its lane %s marked failed\n", row,
+                        row_failed[row] ? "failed" : "did not fail", batch.failed[lane] ? "is" : "is not");
+                return 1;
+            }
+            if (!row_failed[row] && results[lane] != expected[row])
+            {
+                fprintf(stderr, "row %d: sm_run left %d, its lane holds %d\n", row, expected[row], results[lane]);
+                return 1;
+            }
+        }
+    }
+    double batch_time = now() - start;
+
+    printf("%d rows, %d failed, %d lanes per batch\n", ROWS, failed_rows, LANES);
+    printf("%12s %14s\n", "", "Mrows/s");
+    printf("%12s %14.1f\n", "sm_run", ROWS / row_time / 1e6);
+    printf("%12s %14.1f\n", "sm_run_batch", ROWS / batch_time / 1e6);
+
+    sm_batch_destroy(&batch);
+    sm_clear(&stack);
+    sm_program_free(&program);
+    free(extras);
+    free(divisors);
+    free(dividends);
+    free(expected);
+    free(row_failed);
+    free(results);
+    return 0;
+}
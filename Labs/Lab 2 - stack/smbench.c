@@ -0,0 +1,171 @@
+/**
+ * @file smbench.c
+ *
+ * @brief Compares the lock-free stack (stackm_lf.h) with the stack machine
+ *        (stackm.h) behind a mutex, with several threads pushing and popping
+ *        the same stack.  Every thread pushes a value and pops one, over and
+ *        over, and the number of elements left over is checked at the end.
+ *        The gap only shows with threads on separate cores, and the numbers
+ *        only mean something with optimization (make bench builds them with -O2).
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "stackm.h"
+#include "stackm_lf.h"
+
+#define MAX_THREADS 16
+#define DEFAULT_OPS 1000000
+#define PRELOAD 64
+
+static struct stackm_t locked_stack;
+static pthread_mutex_t stack_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct stackm_lf_t lf_stack;
+static int ops_per_thread;
+
+/**
+ * @brief Results of one thread
+ * @property pushed - number of successful pushes
+ * @property popped - number of successful pops
+ */
+struct tally_t
+{
+    long long pushed;
+    long long popped;
+};
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Thread body for the stack machine behind a mutex
+ * @param arg - the tally of the thread
+ * @return NULL
+ */
+static void *locked_worker(void *arg)
+{
+    struct tally_t *tally = (struct tally_t *)arg;
+    for (int i = 0; i < ops_per_thread; i++)
+    {
+        pthread_mutex_lock(&stack_lock);
+        tally->pushed += sm_push(&locked_stack, i) == 0;
+        pthread_mutex_unlock(&stack_lock);
+
+        pthread_mutex_lock(&stack_lock);
+        tally->popped += sm_pop(&locked_stack) == 0;
+        pthread_mutex_unlock(&stack_lock);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Thread body for the lock-free stack
+ * @param arg - the tally of the thread
+ * @return NULL
+ */
+static void *lf_worker(void *arg)
+{
+    struct tally_t *tally = (struct tally_t *)arg;
+    for (int i = 0; i < ops_per_thread; i++)
+    {
+        int value = 0;
+        tally->pushed += sm_lf_push(&lf_stack, i) == 0;
+        tally->popped += sm_lf_pop(&lf_stack, &value) == 0;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Run one variant with the given number of threads
+ * @param worker - the thread body
+ * @param threads - the number of threads
+ * @param leftover - the number of elements the run left on the stack
+ * @return the number of push and pop operations per second
+ */
+static double run(void *(*worker)(void *), int threads, long long (*leftover)(void))
+{
+    pthread_t ids[MAX_THREADS];
+    struct tally_t tallies[MAX_THREADS] = {{0}};
+
+    double start = now();
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_create(&ids[i], NULL, worker, &tallies[i]);
+    }
+    long long pushed = 0;
+    long long popped = 0;
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_join(ids[i], NULL);
+        pushed += tallies[i].pushed;
+        popped += tallies[i].popped;
+    }
+    double elapsed = now() - start;
+
+    if (pushed != popped + leftover())
+    {
+        printf("element count mismatch: pushed %lld, popped %lld\n", pushed, popped);
+        exit(1);
+    }
+    return 2.0 * ops_per_thread * threads / elapsed;
+}
+
+// Preloaded values are on the stack before and after a run, so only the rest is counted
+static long long locked_leftover(void)
+{
+    long long count = sm_size(&locked_stack) - PRELOAD;
+    while (sm_size(&locked_stack) > PRELOAD)
+    {
+        sm_pop(&locked_stack);
+    }
+    return count;
+}
+
+static long long lf_leftover(void)
+{
+    long long count = sm_lf_size(&lf_stack) - PRELOAD;
+    while (sm_lf_size(&lf_stack) > PRELOAD)
+    {
+        sm_lf_pop(&lf_stack, NULL);
+    }
+    return count;
+}
+
+/**
+ * @brief Program entry procedure
+ * @param argc - the number of arguments
+ * @param argv - optional push/pop pairs per thread
+ * @return 0, or 1 if a run lost or duplicated elements
+ */
+int main(int argc, char *argv[])
+{
+    ops_per_thread = argc > 1 ? atoi(argv[1]) : DEFAULT_OPS;
+    sm_init(&locked_stack);
+    sm_lf_init(&lf_stack);
+
+    // Values below the working set, so the threads never drain the stack
+    for (int i = 0; i < PRELOAD; i++)
+    {
+        sm_push(&locked_stack, 0);
+        sm_lf_push(&lf_stack, 0);
+    }
+
+    printf("%d push/pop pairs per thread\n", ops_per_thread);
+    printf("%8s %16s %16s %8s\n", "threads", "mutex Mops/s", "lock-free Mops/s", "speedup");
+    for (int threads = 1; threads <= MAX_THREADS; threads *= 2)
+    {
+        double locked = run(locked_worker, threads, locked_leftover);
+        double lock_free = run(lf_worker, threads, lf_leftover);
+        printf("%8d %16.2f %16.2f %8.2f\n", threads, locked / 1e6, lock_free / 1e6, lock_free / locked);
+    }
+
+    sm_clear(&locked_stack);
+    sm_lf_destroy(&lf_stack);
+    return 0;
+}
@@ -0,0 +1,93 @@
+/**
+ * @file smrotbench.c
+ *
+ * @brief Times sm_rotate on a stack of a million elements for depths from
+ *        2 up to the whole stack, against always moving the elements above
+ *        the 'nth' slot up one (the layout without headroom).  Both stacks
+ *        are compared after every depth.  The numbers only mean something
+ *        with optimization (make bench builds them with -O2).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "stackm.h"
+
+#define STACK_SIZE 1000000
+#define MOVED_PER_DEPTH 200000000LL // Elements the reference moves per depth, at most
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief The rotate being compared against, moving depth - 1 elements every time
+ * @param my_stack - pointer to the stack
+ * @param depth - the depth of rotation, at most the size of the stack
+ */
+static void shift_rotate(struct stackm_t *my_stack, int depth)
+{
+    int *bottom = &my_stack->values[my_stack->size - depth];
+    int save_value = bottom[depth - 1];
+    memmove(bottom + 1, bottom, (depth - 1) * sizeof(int));
+    bottom[0] = save_value;
+}
+
+/**
+ * @brief Program entry procedure
+ * @return 0 if both rotates always agreed, 1 otherwise
+ */
+int main(void)
+{
+    static const int depths[] = {2, 10, 100, 1000, 10000, 100000, 500000, 900000, 1000000};
+
+    struct stackm_t my_stack;
+    struct stackm_t reference;
+    sm_init(&my_stack);
+    sm_init(&reference);
+    for (int i = 0; i < STACK_SIZE; i++)
+    {
+        if (sm_push(&my_stack, i) != 0 || sm_push(&reference, i) != 0)
+        {
+            fprintf(stderr, "out of memory\n");
+            return 1;
+        }
+    }
+
+    printf("%10s %12s %14s %14s\n", "depth", "rotations", "sm_rotate ns", "shift ns");
+    for (int d = 0; d < (int)(sizeof(depths) / sizeof(depths[0])); d++)
+    {
+        int depth = depths[d];
+        long long rotations = MOVED_PER_DEPTH / depth < 1000 ? 1000 : MOVED_PER_DEPTH / depth;
+
+        double start = now();
+        for (long long i = 0; i < rotations; i++)
+        {
+            sm_rotate(&my_stack, depth);
+        }
+        double rotate_time = now() - start;
+
+        start = now();
+        for (long long i = 0; i < rotations; i++)
+        {
+            shift_rotate(&reference, depth);
+        }
+        double shift_time = now() - start;
+
+        if (memcmp(my_stack.values, reference.values, STACK_SIZE * sizeof(int)) != 0)
+        {
+            fprintf(stderr, "stacks differ after rotating %d deep\n", depth);
+            return 1;
+        }
+        printf("%10d %12lld %14.1f %14.1f\n", depth, rotations, rotate_time / rotations * 1e9,
+               shift_time / rotations * 1e9);
+    }
+
+    sm_clear(&my_stack);
+    sm_clear(&reference);
+    return 0;
+}
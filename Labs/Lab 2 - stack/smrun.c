@@ -0,0 +1,105 @@
+/**
+ * @file smrun.c
+ *
+ * @brief Assembles and verifies a stack machine program file (see smvm.h), runs
+ *        it on an empty stack and prints the final stack.  With a repeat
+ *        count the program is run that many more times (each on an empty
+ *        stack) and the number of operations executed per second is reported.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "smvm.h"
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Count the operations of a program
+ * @param program - the program
+ * @return the number of operations, not counting the final halt
+ */
+static long long count_ops(const struct sm_program_t *program)
+{
+    long long ops = 0;
+    for (int pc = 0; pc < program->length - 1; pc += sm_has_operand(program->code[pc]) ? 1 + (int)sizeof(int) : 1)
+    {
+        ops++;
+    }
+    return ops;
+}
+
+/**
+ * @brief Program entry procedure
+ * @param argc - the number of arguments
+ * @param argv - the program file and an optional repeat count
+ * @return 0 if the program ran to the end, 1 otherwise
+ */
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s program.sm [repeat]\n", argv[0]);
+        return 1;
+    }
+    int repeat = argc > 2 ? atoi(argv[2]) : 0;
+
+    struct sm_program_t program;
+    int error_line;
+    sm_program_init(&program);
+    if (sm_program_load(&program, argv[1], &error_line) != 0)
+    {
+        if (error_line == 0)
+        {
+            perror(argv[1]);
+        }
+        else
+        {
+            fprintf(stderr, "%s:%d: cannot assemble line\n", argv[1], error_line);
+        }
+        return 1;
+    }
+
+    // Runs start on an empty stack, so every operation the verifier rejects would fail
+    int failed_at;
+    if (sm_verify(&program, 0, &failed_at) != 0)
+    {
+        fprintf(stderr, "%s: operation at byte %d runs out of elements\n", argv[1], failed_at);
+        sm_program_free(&program);
+        return 1;
+    }
+
+    struct stackm_t my_stack;
+    sm_init(&my_stack);
+    if (sm_run(&my_stack, &program, &failed_at) != 0)
+    {
+        fprintf(stderr, "%s: operation at byte %d failed\n", argv[1], failed_at);
+        sm_print(&my_stack);
+        sm_clear(&my_stack);
+        sm_program_free(&program);
+        return 1;
+    }
+    sm_print(&my_stack);
+
+    if (repeat > 0)
+    {
+        double start = now();
+        for (int i = 0; i < repeat; i++)
+        {
+            sm_clear(&my_stack);
+            sm_run(&my_stack, &program, NULL);
+        }
+        double elapsed = now() - start;
+        printf("%lld operations x %d runs: %.1f Mops/s\n", count_ops(&program), repeat,
+               count_ops(&program) * repeat / elapsed / 1e6);
+    }
+
+    sm_clear(&my_stack);
+    sm_program_free(&program);
+    return 0;
+}
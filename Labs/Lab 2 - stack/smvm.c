@@ -0,0 +1,643 @@
+/**
+ * @file smvm.c
+ *
+ * @brief Implementation of the stack machine programs declared in smvm.h
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "smvm.h"
+
+#define OPERAND_SIZE ((int)sizeof(int))
+
+/**
+ * @brief assembly mnemonic
+ * @property name - the mnemonic (lower case)
+ * @property op - the SM_OP_* operation
+ * @property has_operand - 1 if the operation takes an operand
+ */
+struct mnemonic_t
+{
+    const char *name;
+    int op;
+    int has_operand;
+};
+
+static const struct mnemonic_t mnemonics[] = {
+    {"push", SM_OP_PUSH, 1},
+    {"pop", SM_OP_POP, 0},
+    {"add", SM_OP_ADD, 0},
+    {"sub", SM_OP_SUB, 0},
+    {"mult", SM_OP_MULT, 0},
+    {"div", SM_OP_DIV, 0},
+    {"rotate", SM_OP_ROTATE, 1},
+    {"clear", SM_OP_CLEAR, 0},
+    {"print", SM_OP_PRINT, 0},
+};
+
+int sm_has_operand(int op)
+{
+    return op == SM_OP_PUSH || op == SM_OP_ROTATE;
+}
+
+void sm_program_init(struct sm_program_t *program)
+{
+    program->code = NULL;
+    program->length = 0;
+    program->capacity = 0;
+    program->verified = 0;
+    program->entry_depth = 0;
+    program->max_depth = 0;
+}
+
+void sm_program_free(struct sm_program_t *program)
+{
+    free(program->code);
+    sm_program_init(program);
+}
+
+int sm_emit(struct sm_program_t *program, int op, int operand)
+{
+    if (op <= SM_OP_HALT || op >= SM_OP_COUNT)
+    {
+        return -1; // Unknown operation
+    }
+
+    // The new operation replaces the final halt, which goes back on after it
+    int start = program->length > 0 ? program->length - 1 : 0;
+    int needed = start + 1 + OPERAND_SIZE + 1;
+    if (needed > program->capacity)
+    {
+        int capacity = program->capacity == 0 ? 64 : program->capacity;
+        while (capacity < needed)
+        {
+            capacity *= 2;
+        }
+        unsigned char *code = (unsigned char *)realloc(program->code, capacity);
+        if (code == NULL)
+        {
+            return -1; // Memory allocation failure
+        }
+        program->code = code;
+        program->capacity = capacity;
+    }
+
+    unsigned char *pc = program->code + start;
+    *pc++ = (unsigned char)op;
+    if (sm_has_operand(op))
+    {
+        memcpy(pc, &operand, OPERAND_SIZE);
+        pc += OPERAND_SIZE;
+    }
+    *pc++ = SM_OP_HALT;
+    program->length = (int)(pc - program->code);
+    program->verified = 0;
+
+    return 0;
+}
+
+// Translate one line, returns 0 if it was appended or holds no operation
+static int assemble_line(struct sm_program_t *program, const char *line, const char *end)
+{
+    while (line < end && isspace((unsigned char)*line))
+    {
+        line++;
+    }
+    if (line == end || *line == '#')
+    {
+        return 0; // Blank or comment
+    }
+
+    // Mnemonic
+    char name[16];
+    int length = 0;
+    while (line < end && isalpha((unsigned char)*line))
+    {
+        if (length == (int)sizeof(name) - 1)
+        {
+            return -1; // Too long to be a mnemonic
+        }
+        name[length++] = (char)tolower((unsigned char)*line++);
+    }
+    name[length] = '\0';
+
+    const struct mnemonic_t *mnemonic = NULL;
+    for (int i = 0; i < (int)(sizeof(mnemonics) / sizeof(mnemonics[0])); i++)
+    {
+        if (strcmp(name, mnemonics[i].name) == 0)
+        {
+            mnemonic = &mnemonics[i];
+        }
+    }
+    if (mnemonic == NULL)
+    {
+        return -1; // Unknown mnemonic
+    }
+
+    // Operand
+    long operand = 0;
+    if (mnemonic->has_operand)
+    {
+        char digits[32];
+        while (line < end && (*line == ' ' || *line == '\t'))
+        {
+            line++;
+        }
+        length = 0;
+        while (line < end && (isdigit((unsigned char)*line) || ((*line == '-' || *line == '+') && length == 0)))
+        {
+            if (length == (int)sizeof(digits) - 1)
+            {
+                return -1; // Out of range
+            }
+            digits[length++] = *line++;
+        }
+        digits[length] = '\0';
+
+        char *digits_end;
+        errno = 0;
+        operand = strtol(digits, &digits_end, 10);
+        if (length == 0 || *digits_end != '\0' || errno != 0 || operand < INT_MIN || operand > INT_MAX)
+        {
+            return -1; // Missing or bad operand
+        }
+    }
+
+    // Nothing but a comment may follow
+    while (line < end && isspace((unsigned char)*line))
+    {
+        line++;
+    }
+    if (line < end && *line != '#')
+    {
+        return -1;
+    }
+
+    return sm_emit(program, mnemonic->op, (int)operand);
+}
+
+int sm_assemble(struct sm_program_t *program, const char *source, int *error_line)
+{
+    int saved_length = program->length;
+    int line_number = 1;
+
+    while (*source != '\0')
+    {
+        const char *end = strchr(source, '\n');
+        if (end == NULL)
+        {
+            end = source + strlen(source);
+        }
+
+        if (assemble_line(program, source, end) != 0)
+        {
+            // Drop everything appended by this call
+            program->length = saved_length;
+            if (program->code != NULL)
+            {
+                // An empty program keeps its buffer, so it needs the halt as well
+                program->code[saved_length > 0 ? saved_length - 1 : 0] = SM_OP_HALT;
+            }
+            if (error_line != NULL)
+            {
+                *error_line = line_number;
+            }
+            return -1;
+        }
+
+        source = *end == '\n' ? end + 1 : end;
+        line_number++;
+    }
+
+    return 0;
+}
+
+int sm_program_load(struct sm_program_t *program, const char *path, int *error_line)
+{
+    if (error_line != NULL)
+    {
+        *error_line = 0;
+    }
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        return -1;
+    }
+
+    // Read the whole file into one string
+    size_t length = 0;
+    size_t capacity = 4096;
+    char *source = (char *)malloc(capacity);
+    while (source != NULL)
+    {
+        length += fread(source + length, 1, capacity - length - 1, file);
+        if (length < capacity - 1)
+        {
+            break;
+        }
+        capacity *= 2;
+        char *larger = (char *)realloc(source, capacity);
+        if (larger == NULL)
+        {
+            free(source);
+        }
+        source = larger;
+    }
+    int failed = source == NULL || ferror(file);
+    fclose(file);
+    if (failed)
+    {
+        free(source);
+        return -1;
+    }
+    source[length] = '\0';
+
+    int result = sm_assemble(program, source, error_line);
+    free(source);
+    return result;
+}
+
+int sm_verify(struct sm_program_t *program, int entry_depth, int *failed_at)
+{
+    program->verified = 0;
+    if (entry_depth < 0)
+    {
+        return -1;
+    }
+
+    const unsigned char *code = program->code;
+    int depth = entry_depth;
+    int max_depth = entry_depth;
+    int pc = 0;
+    int operand = 0;
+
+    while (pc < program->length)
+    {
+        int op = code[pc];
+        int next = pc + 1;
+        if (op >= SM_OP_COUNT)
+        {
+            break; // Not an operation
+        }
+        if (sm_has_operand(op))
+        {
+            if (next + OPERAND_SIZE > program->length)
+            {
+                break; // Operand runs past the end
+            }
+            memcpy(&operand, code + next, OPERAND_SIZE);
+            next += OPERAND_SIZE;
+        }
+
+        // Depth after the operation, or -1 if it could fail
+        switch (op)
+        {
+        case SM_OP_HALT:
+            if (next != program->length)
+            {
+                break; // Halt has to be the last operation
+            }
+            program->verified = 1;
+            program->entry_depth = entry_depth;
+            program->max_depth = max_depth;
+            return 0;
+        case SM_OP_PUSH:
+            depth = depth == INT_MAX ? -1 : depth + 1;
+            break;
+        case SM_OP_POP:
+            depth--;
+            break;
+        case SM_OP_ADD:
+        case SM_OP_SUB:
+        case SM_OP_MULT:
+        case SM_OP_DIV:
+            depth = depth < 2 ? -1 : depth - 1;
+            break;
+        case SM_OP_ROTATE:
+            if (operand < 0 || (operand > 1 && operand > depth))
+            {
+                depth = -1;
+            }
+            break;
+        case SM_OP_CLEAR:
+            depth = 0;
+            break;
+        case SM_OP_PRINT:
+            break;
+        }
+        if (op == SM_OP_HALT || depth < 0)
+        {
+            break;
+        }
+        if (depth > max_depth)
+        {
+            max_depth = depth;
+        }
+        pc = next;
+    }
+
+    if (failed_at != NULL)
+    {
+        *failed_at = pc;
+    }
+    return -1;
+}
+
+int sm_run(struct stackm_t *my_stack, const struct sm_program_t *program, int *failed_at)
+{
+    // One label per operation, in SM_OP_* order
+    static void *const labels[SM_OP_COUNT] = {&&op_halt, &&op_push, &&op_pop,    &&op_add,   &&op_sub,
+                                              &&op_mult, &&op_div,  &&op_rotate, &&op_clear, &&op_print};
+    // The same without depth checks, for verified programs
+    static void *const unchecked_labels[SM_OP_COUNT] = {
+        &&op_halt,           &&unchecked_push,   &&unchecked_pop,    &&unchecked_add,   &&unchecked_sub,
+        &&unchecked_mult,    &&unchecked_div,    &&unchecked_rotate, &&unchecked_clear, &&op_print};
+
+    const unsigned char *pc = program->code;
+    if (program->length == 0)
+    {
+        return 0; // Empty program, its buffer may still hold discarded operations
+    }
+
+    // A verified program never goes deeper than max_depth above where it started, so
+    // once the array has room for that no operation can leave the array
+    void *const *table = labels;
+    if (program->verified && my_stack->size >= program->entry_depth &&
+        my_stack->size - program->entry_depth <= INT_MAX - program->max_depth &&
+        sm_reserve(my_stack, my_stack->size - program->entry_depth + program->max_depth) == 0)
+    {
+        table = unchecked_labels;
+    }
+
+    // The top of the stack is kept in locals and written back before any sm_* call
+    int *values = my_stack->values;
+    int size = my_stack->size;
+    int operand;
+
+#define DISPATCH() goto *table[*pc]
+#define FETCH_OPERAND() memcpy(&operand, pc + 1, OPERAND_SIZE)
+
+    DISPATCH();
+
+op_push:
+    FETCH_OPERAND();
+    if (size == my_stack->capacity)
+    {
+        // Growing the array is left to sm_push
+        my_stack->size = size;
+        if (sm_push(my_stack, operand) != 0)
+        {
+            goto fail;
+        }
+        values = my_stack->values;
+        size = my_stack->size;
+    }
+    else
+    {
+        values[size++] = operand;
+    }
+    pc += 1 + OPERAND_SIZE;
+    DISPATCH();
+
+op_pop:
+    if (size == 0)
+    {
+        goto fail;
+    }
+    size--;
+    pc++;
+    DISPATCH();
+
+op_add:
+    if (size < 2)
+    {
+        goto fail;
+    }
+    values[size - 2] = values[size - 1] + values[size - 2];
+    size--;
+    pc++;
+    DISPATCH();
+
+op_sub:
+    if (size < 2)
+    {
+        goto fail;
+    }
+    values[size - 2] = values[size - 1] - values[size - 2];
+    size--;
+    pc++;
+    DISPATCH();
+
+op_mult:
+    if (size < 2)
+    {
+        goto fail;
+    }
+    values[size - 2] = values[size - 1] * values[size - 2];
+    size--;
+    pc++;
+    DISPATCH();
+
+op_div:
+    if (size < 2 || values[size - 2] == 0 || (values[size - 1] == INT_MIN && values[size - 2] == -1))
+    {
+        goto fail;
+    }
+    values[size - 2] = values[size - 1] / values[size - 2];
+    size--;
+    pc++;
+    DISPATCH();
+
+op_rotate:
+    // The common rotate 2 is a swap, deeper ones are left to sm_rotate
+    FETCH_OPERAND();
+    if (operand == 2 && size >= 2)
+    {
+        int save_value = values[size - 1];
+        values[size - 1] = values[size - 2];
+        values[size - 2] = save_value;
+    }
+    else if (operand > 1 || operand < 0)
+    {
+        my_stack->size = size;
+        if (sm_rotate(my_stack, operand) != 0)
+        {
+            goto fail;
+        }
+        values = my_stack->values;
+    }
+    pc += 1 + OPERAND_SIZE;
+    DISPATCH();
+
+op_clear:
+    sm_clear(my_stack);
+    values = my_stack->values;
+    size = my_stack->size;
+    pc++;
+    DISPATCH();
+
+unchecked_push:
+    FETCH_OPERAND();
+    values[size++] = operand;
+    pc += 1 + OPERAND_SIZE;
+    DISPATCH();
+
+unchecked_pop:
+    size--;
+    pc++;
+    DISPATCH();
+
+unchecked_add:
+    values[size - 2] = values[size - 1] + values[size - 2];
+    size--;
+    pc++;
+    DISPATCH();
+
+unchecked_sub:
+    values[size - 2] = values[size - 1] - values[size - 2];
+    size--;
+    pc++;
+    DISPATCH();
+
+unchecked_mult:
+    values[size - 2] = values[size - 1] * values[size - 2];
+    size--;
+    pc++;
+    DISPATCH();
+
+unchecked_div:
+    // The divisor depends on the values, so it is still checked
+    if (values[size - 2] == 0 || (values[size - 1] == INT_MIN && values[size - 2] == -1))
+    {
+        goto fail;
+    }
+    values[size - 2] = values[size - 1] / values[size - 2];
+    size--;
+    pc++;
+    DISPATCH();
+
+unchecked_rotate:
+    // As sm_rotate, except that it never makes new headroom: that takes slots
+    // from above the stack, which the pushes still to come were promised
+    FETCH_OPERAND();
+    if (operand > 1)
+    {
+        int below = size - operand;
+        int save_value = values[size - 1];
+        if (operand == 2)
+        {
+            values[size - 1] = values[size - 2];
+            values[size - 2] = save_value;
+        }
+        else if (operand - 1 > below && my_stack->headroom > 0)
+        {
+            memmove(values - 1, values, below * sizeof(int));
+            values[below - 1] = save_value;
+            values--;
+            my_stack->values = values;
+            my_stack->capacity++;
+            my_stack->headroom--;
+        }
+        else
+        {
+            memmove(values + below + 1, values + below, (operand - 1) * sizeof(int));
+            values[below] = save_value;
+        }
+    }
+    pc += 1 + OPERAND_SIZE;
+    DISPATCH();
+
+unchecked_clear:
+    // The array stays, the rest of the program still needs its room
+    size = 0;
+    pc++;
+    DISPATCH();
+
+op_print:
+    my_stack->size = size;
+    sm_print(my_stack);
+    pc++;
+    DISPATCH();
+
+op_halt:
+    my_stack->size = size;
+    return 0;
+
+fail:
+    my_stack->size = size;
+    if (failed_at != NULL)
+    {
+        *failed_at = (int)(pc - program->code);
+    }
+    return -1;
+
+#undef DISPATCH
+#undef FETCH_OPERAND
+}
+
+int sm_run_batch(struct stackm_batch_t *my_stack, const struct sm_program_t *program, int *failed_at)
+{
+    const unsigned char *pc = program->code;
+    if (program->length == 0)
+    {
+        return 0; // Empty program, its buffer may still hold discarded operations
+    }
+
+    // Every operation covers a whole batch, so a plain switch costs next to nothing per row
+    int operand = 0;
+    int result = 0;
+    while (*pc != SM_OP_HALT && result == 0)
+    {
+        if (sm_has_operand(*pc))
+        {
+            memcpy(&operand, pc + 1, OPERAND_SIZE);
+        }
+
+        switch (*pc)
+        {
+        case SM_OP_PUSH:
+            result = sm_batch_push_value(my_stack, operand);
+            break;
+        case SM_OP_POP:
+            result = sm_batch_pop(my_stack);
+            break;
+        case SM_OP_ADD:
+            result = sm_batch_add(my_stack);
+            break;
+        case SM_OP_SUB:
+            result = sm_batch_sub(my_stack);
+            break;
+        case SM_OP_MULT:
+            result = sm_batch_mult(my_stack);
+            break;
+        case SM_OP_DIV:
+            result = sm_batch_div(my_stack);
+            break;
+        case SM_OP_ROTATE:
+            result = sm_batch_rotate(my_stack, operand);
+            break;
+        case SM_OP_CLEAR:
+            sm_batch_clear(my_stack);
+            break;
+        case SM_OP_PRINT:
+            sm_batch_print(my_stack);
+            break;
+        }
+
+        if (result == 0)
+        {
+            pc += sm_has_operand(*pc) ? 1 + OPERAND_SIZE : 1;
+        }
+    }
+
+    if (result != 0 && failed_at != NULL)
+    {
+        *failed_at = (int)(pc - program->code);
+    }
+    return result;
+}
@@ -0,0 +1,177 @@
+/**
+ * @file smvm.h
+ *
+ * @brief External (public) declarations for running whole programs on the
+ *        stack machine.
+ *
+ * A program is a compact bytecode: one byte per operation, followed by a
+ * 4 byte operand for push and rotate.  Programs are built from text with
+ * sm_assemble (or sm_program_load for a file), or one operation at a time
+ * with sm_emit, and always end with SM_OP_HALT.
+ *
+ * Assembly has one operation per line, upper or lower case, and anything
+ * after a '#' is a comment:
+ *
+ *        push 10      # push a value
+ *        push 2
+ *        div          # 2 / 10, as sm_div
+ *        rotate 3     # as sm_rotate
+ *        pop, add, sub, mult, clear and print map to the sm_* functions
+ *
+ * sm_run executes a program over a stackm_t with the same results as the
+ * matching sm_* calls, but dispatches straight from one operation to the
+ * next (computed goto) instead of making a function call per operation.
+ *
+ * sm_verify follows the stack depth through a program ahead of time and
+ * rejects programs that would run out of elements.  A verified program
+ * runs with unchecked operations whenever the stack holds at least the
+ * elements it was verified for: the array is grown once up front, and
+ * only division still tests its divisor.
+ *
+ * sm_run_batch executes a program over a stackm_batch_t, so the same
+ * program is evaluated for every row of a batch with one dispatch per
+ * operation rather than one per operation per row.
+ */
+
+#ifndef SMVM_H
+#define SMVM_H
+
+#include "stackm.h"
+#include "stackm_batch.h"
+
+/* Operations, each is one byte in the bytecode */
+#define SM_OP_HALT   0  // End of the program
+#define SM_OP_PUSH   1  // sm_push of the 4 byte operand
+#define SM_OP_POP    2  // sm_pop
+#define SM_OP_ADD    3  // sm_add
+#define SM_OP_SUB    4  // sm_sub
+#define SM_OP_MULT   5  // sm_mult
+#define SM_OP_DIV    6  // sm_div
+#define SM_OP_ROTATE 7  // sm_rotate by the 4 byte operand
+#define SM_OP_CLEAR  8  // sm_clear
+#define SM_OP_PRINT  9  // sm_print
+#define SM_OP_COUNT  10
+
+/* Structures */
+
+/**
+ * @brief structure for a program
+ * @property code - the bytecode, always ending with SM_OP_HALT
+ * @property length - number of bytes in code, including the final SM_OP_HALT
+ * @property capacity - number of bytes allocated for code
+ * @property verified - 1 if sm_verify accepted the program as it is now
+ * @property entry_depth - elements the stack needs at the start (if verified)
+ * @property max_depth - most elements on the stack at any point, when starting
+ *                       with entry_depth elements (if verified)
+ */
+struct sm_program_t
+{
+    unsigned char *code;
+    int length;
+    int capacity;
+    int verified;
+    int entry_depth;
+    int max_depth;
+};
+
+/* Program methods */
+
+/**
+ * @brief Reports whether an operation is followed by a 4 byte operand.
+ * @param op - one of the SM_OP_* operations
+ * @return 1 for SM_OP_PUSH and SM_OP_ROTATE
+ * @return 0 otherwise
+ */
+int sm_has_operand(int op);
+
+/**
+ * @brief Initialize a program structure as an empty program.
+ * @param program - a pointer to the structure to be init
+ */
+void sm_program_init(struct sm_program_t *program);
+
+/**
+ * @brief Releases all dynamic memory of a program.  The program is empty
+ *        and able to be reused afterwards.
+ * @param program - pointer to the program
+ */
+void sm_program_free(struct sm_program_t *program);
+
+/**
+ * @brief Append one operation to the end of a program.
+ *        A verified program has to be verified again afterwards.
+ * @param program - pointer to the program
+ * @param op - one of the SM_OP_* operations other than SM_OP_HALT
+ * @param operand - the value to push or the rotate depth (ignored by other operations)
+ * @return -1 if the operation is unknown or memory could not be allocated
+ * @return 0 if the operation was appended
+ */
+int sm_emit(struct sm_program_t *program, int op, int operand);
+
+/**
+ * @brief Translate assembly text (see the top of this file) and append it to a program.
+ * @param program - pointer to the program
+ * @param source - the assembly text
+ * @param error_line - set to the number of the first bad line on failure (may be NULL)
+ * @return -1 if a line could not be translated (nothing is appended)
+ * @return 0 if the whole text was appended
+ */
+int sm_assemble(struct sm_program_t *program, const char *source, int *error_line);
+
+/**
+ * @brief Read an assembly file and append it to a program (see sm_assemble).
+ * @param program - pointer to the program
+ * @param path - the file to read
+ * @param error_line - set to the number of the first bad line, or 0 if the file
+ *                     could not be read (may be NULL)
+ * @return -1 if the file could not be read or translated
+ * @return 0 if the whole file was appended
+ */
+int sm_program_load(struct sm_program_t *program, const char *path, int *error_line);
+
+/**
+ * @brief Check ahead of time that the bytecode is well formed and that no
+ *        operation runs out of elements when the program starts on a stack
+ *        of at least entry_depth elements.
+ *        Division by zero is not checked, it depends on the values.
+ * @param program - pointer to the program, marked verified on success
+ * @param entry_depth - the fewest elements the stack will hold when the program starts
+ * @param failed_at - set to the byte offset of the first operation that
+ *                    could fail (may be NULL)
+ * @return -1 if an operation could run out of elements or the bytecode is
+ *         malformed (the program is not verified)
+ * @return 0 if the program was verified
+ */
+int sm_verify(struct sm_program_t *program, int entry_depth, int *failed_at);
+
+/**
+ * @brief Run a program on a stack.
+ *        Every operation behaves exactly like the matching sm_* call.  The
+ *        program stops at the first operation that fails, which leaves the
+ *        stack as it was before that operation.
+ *        A verified program skips the depth checks (see sm_verify) if the stack
+ *        holds at least entry_depth elements.  Its clear operations then keep
+ *        the array for reuse instead of releasing it.
+ * @param my_stack - pointer to the stack
+ * @param program - pointer to the program
+ * @param failed_at - set to the byte offset of the failed operation (may be NULL)
+ * @return -1 if an operation failed
+ * @return 0 if the program ran to the end
+ */
+int sm_run(struct stackm_t *my_stack, const struct sm_program_t *program, int *failed_at);
+
+/**
+ * @brief Run a program on every row of a batch stack.
+ *        Each operation is the matching sm_batch_* call, push broadcasts its
+ *        operand to every lane.  Running out of slots or a bad rotate stops
+ *        the whole batch as sm_run would, while a failed division only marks
+ *        its lanes in my_stack->failed (see stackm_batch.h) and the program goes on.
+ * @param my_stack - pointer to the batch stack, holding the input columns
+ * @param program - pointer to the program
+ * @param failed_at - set to the byte offset of the failed operation (may be NULL)
+ * @return -1 if an operation failed for the whole batch
+ * @return 0 if the program ran to the end
+ */
+int sm_run_batch(struct stackm_batch_t *my_stack, const struct sm_program_t *program, int *failed_at);
+
+#endif
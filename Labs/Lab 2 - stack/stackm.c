@@ -0,0 +1,262 @@
+/**
+ * @file stackm.c
+ *
+ * @brief Implementation of the stack machine declared in stackm.h
+ */
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stackm.h"
+
+void sm_init(struct stackm_t *my_stack)
+{
+    my_stack->values = NULL;
+    my_stack->size = 0;
+    my_stack->capacity = 0;
+    my_stack->headroom = 0;
+}
+
+int sm_size(struct stackm_t *my_stack)
+{
+    return my_stack->size;
+}
+
+int sm_reserve(struct stackm_t *my_stack, int capacity)
+{
+    if (capacity <= my_stack->capacity)
+    {
+        return 0; // Already large enough
+    }
+
+    // Double the array so a long run of pushes only reallocates a few times
+    int new_capacity = my_stack->capacity == 0 ? SM_INITIAL_CAPACITY : my_stack->capacity;
+    while (new_capacity < capacity)
+    {
+        if (new_capacity > INT_MAX / 2)
+        {
+            return -1; // Stack cannot grow any further
+        }
+        new_capacity *= 2;
+    }
+    if (new_capacity > INT_MAX - my_stack->headroom)
+    {
+        return -1; // Stack cannot grow any further
+    }
+
+    // The headroom below the elements moves along with them
+    int *block = my_stack->values == NULL ? NULL : my_stack->values - my_stack->headroom;
+    block = (int *)realloc(block, ((size_t)my_stack->headroom + new_capacity) * sizeof(int));
+    if (block == NULL)
+    {
+        return -1; // Memory allocation failure
+    }
+    my_stack->values = block + my_stack->headroom;
+    my_stack->capacity = new_capacity;
+
+    return 0;
+}
+
+int sm_push(struct stackm_t *my_stack, int to_store)
+{
+    if (my_stack->size == my_stack->capacity && sm_reserve(my_stack, my_stack->size + 1) != 0)
+    {
+        return -1; // Memory allocation failure
+    }
+
+    my_stack->values[my_stack->size++] = to_store;
+
+    return 0; // Successful push
+}
+
+int sm_pop(struct stackm_t *my_stack)
+{
+    if (my_stack->size == 0)
+    {
+        return -1; // Stack is empty
+    }
+
+    my_stack->size--;
+
+    return 0; // Successful pop
+}
+
+int sm_top(struct stackm_t *my_stack, int *to_store)
+{
+    if (my_stack->size == 0 || to_store == NULL)
+    {
+        return -1; // Stack is empty or to_store is NULL
+    }
+
+    *to_store = my_stack->values[my_stack->size - 1];
+    printf("Stack Top: ");
+    return 0; // Successful top
+}
+
+void sm_clear(struct stackm_t *my_stack)
+{
+    if (my_stack->values != NULL)
+    {
+        free(my_stack->values - my_stack->headroom);
+    }
+    sm_init(my_stack);
+}
+
+void sm_print(struct stackm_t *my_stack)
+{
+    int i = my_stack->size - 1;
+
+    // Case: Stack is empty
+    if (i < 0)
+    {
+        printf("\nStack is empty\n\n");
+        return;
+    }
+
+    printf("Stack Contents:\n");
+
+    // Case: Stack Top
+    printf("%d", my_stack->values[i]);
+    if (i == 0)
+    {
+        printf("\t<-Top & Bottom\n");
+        printf("\n");
+        return;
+    }
+    printf("\t<-Top\n");
+    i--;
+
+    // Case: Stack Contents
+    while (i > 0)
+    {
+        printf("%d\n", my_stack->values[i]);
+        i--;
+    }
+
+    // Case: Last element in the stack
+    printf("%d\t<-Bottom\n", my_stack->values[0]);
+    printf("\n");
+}
+
+int sm_add(struct stackm_t *my_stack)
+{
+    if (my_stack->size < 2)
+    {
+        return -1; // Not enough elements on the stack
+    }
+
+    // The result replaces the second element, which becomes the top
+    int *top = &my_stack->values[my_stack->size - 1];
+    top[-1] = top[0] + top[-1];
+    my_stack->size--;
+
+    return 0;
+}
+
+int sm_sub(struct stackm_t *my_stack)
+{
+    if (my_stack->size < 2)
+    {
+        return -1; // Not enough elements on the stack
+    }
+
+    int *top = &my_stack->values[my_stack->size - 1];
+    top[-1] = top[0] - top[-1];
+    my_stack->size--;
+
+    return 0;
+}
+
+int sm_mult(struct stackm_t *my_stack)
+{
+    if (my_stack->size < 2)
+    {
+        return -1; // Not enough elements on the stack
+    }
+
+    int *top = &my_stack->values[my_stack->size - 1];
+    top[-1] = top[0] * top[-1];
+    my_stack->size--;
+
+    return 0;
+}
+
+int sm_div(struct stackm_t *my_stack)
+{
+    if (my_stack->size < 2)
+    {
+        return -1; // Not enough elements on the stack
+    }
+
+    // TOS is divided by the element below it
+    int *top = &my_stack->values[my_stack->size - 1];
+    if (top[-1] == 0 || (top[0] == INT_MIN && top[-1] == -1))
+    {
+        return -1; // Division by zero or the quotient overflows
+    }
+    top[-1] = top[0] / top[-1];
+    my_stack->size--;
+
+    return 0;
+}
+
+int sm_rotate(struct stackm_t *my_stack, int depth)
+{
+    if (depth < 0)
+    {
+        return -1; // Invalid depth
+    }
+
+    if (depth <= 1)
+    {
+        // No rotation needed for depth less than or equal to 1
+        return 0;
+    }
+
+    if (depth > my_stack->size)
+    {
+        return -1; // Invalid depth
+    }
+
+    int *values = my_stack->values;
+    int size = my_stack->size;
+    int below = size - depth; // Elements under the rotated ones
+    int save_value = values[size - 1];
+
+    if (depth - 1 > below)
+    {
+        if (my_stack->headroom == 0)
+        {
+            // Move the whole stack up into half of the spare slots above it, once the
+            // rotates like this one that the new headroom allows save more than that
+            int gap = (my_stack->capacity - size) / 2;
+            if ((long long)gap * (depth - 1 - below) > size)
+            {
+                memmove(values + gap, values, size * sizeof(int));
+                values += gap;
+                my_stack->capacity -= gap;
+                my_stack->headroom = gap;
+            }
+        }
+
+        if (my_stack->headroom > 0)
+        {
+            // The elements under the 'nth' slot move down one into the headroom and
+            // the top takes the slot they left, the old top slot is no longer used
+            memmove(values - 1, values, below * sizeof(int));
+            values[below - 1] = save_value;
+            my_stack->values = values - 1;
+            my_stack->capacity++;
+            my_stack->headroom--;
+            return 0; // Rotation successful
+        }
+    }
+
+    // The top drops to the 'nth' slot and the elements above that slot move up one
+    int *bottom = &values[below];
+    memmove(bottom + 1, bottom, (depth - 1) * sizeof(int));
+    bottom[0] = save_value;
+
+    return 0; // Rotation successful
+}
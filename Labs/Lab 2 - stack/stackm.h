@@ -7,12 +7,19 @@
  *
  * @brief External (public) declarations for stack machine in C.
  *
- * This stack will know about the top.  Each element must point
- * to the one below it in the stack.
+ * The elements are kept in one contiguous array, bottom first, so the
+ * top is the last used slot.  The array doubles whenever it fills, so
+ * pushing and popping do not call the allocator in the common case and
+ * the operations below work on neighbouring slots in place.
  *
- * Note that the pop operations do not return a reference to the
- * popped node.  This would require storage for the node to be
- * released by the user, which could lead to memory mishandling.
+ * The array may also have spare slots below the bottom (headroom), like
+ * one end of a deque.  A deep rotate then moves the few elements under
+ * the rotated ones down a slot instead of the many above them up a slot,
+ * so a rotate moves at most half the stack and rotating the whole stack
+ * moves nothing.  Rotate never allocates memory.
+ *
+ * Note that the pop operations do not return the popped value,
+ * it should be read with sm_top first.
  * The stack size is unbounded so memory must be allocated and
  * freed as appropriate when operations are performed.
  *
@@ -25,26 +32,23 @@
 #ifndef STACKM_H
 #define STACKM_H
 
-/* Structures */
+#define SM_INITIAL_CAPACITY 16 // Slots allocated by the first push
 
-/**
- * @brief stack node
- * @property value - the value of the stack element
- * @property next - pointer to the next node (down) in the stack
- */
-struct node_t
-{
-    int value;
-    struct node_t *next;
-};
+/* Structures */
 
 /**
  * @brief structure for a stack
- * @property top - pointer to the first element in the stack
+ * @property values - the elements, bottom first (NULL until the first push)
+ * @property size - number of elements on the stack
+ * @property capacity - number of slots from values up
+ * @property headroom - number of spare slots allocated below values
  */
 struct stackm_t
 {
-    struct node_t *top;
+    int *values;
+    int size;
+    int capacity;
+    int headroom;
 };
 
 /* Stack Machine methods
@@ -54,21 +58,30 @@ struct stackm_t
 
 /**
  * @brief Initialize a stack machine structure.
- *        An empty stack will be characterized by top being NULL.
+ *        An empty stack will be characterized by size being 0.
  * @param my_stack - a pointer to the structure to be init
  */
 void sm_init(struct stackm_t *my_stack);
 
 /**
  * @brief Reports the current size of the stack.
- *        Must iterate the stack to get this data size there is no size property.
  * @param my_stack - pointer to the stack
  * @return the size of the stack
  */
 int sm_size(struct stackm_t *my_stack);
 
 /**
- * @brief Add a new node with provided data to the top of the stack.
+ * @brief Make room for at least 'capacity' elements, so pushes up to that
+ *        size do not need to allocate memory.
+ * @param my_stack - pointer to the stack
+ * @param capacity - the number of elements to make room for
+ * @return -1 if the memory could not be allocated
+ * @return 0 if the stack has room for capacity elements
+ */
+int sm_reserve(struct stackm_t *my_stack, int capacity);
+
+/**
+ * @brief Add a new element with provided data to the top of the stack.
  *        This method should allocate memory as needed and check to
  *        make sure that the memory was allocated successfully.
  * @param my_stack - pointer to the stack
@@ -81,7 +94,7 @@ int sm_push(struct stackm_t *my_stack, int to_store);
 /**
  * @brief Removes top item in stack
  *        Note, this does not return any data from the stack.
- *        If the data in the node is needed it should be accessed
+ *        If the value of the element is needed it should be accessed
  *        prior to the pop (sm_top).
  * @param my_stack - pointer to the stack
  * @return -1 if pop could not be performed (i.e stack is empty)
@@ -109,7 +122,7 @@ int sm_top(struct stackm_t *my_stack, int *to_store);
  *         Returns: nothing
  */
 /**
- * @brief Clears all nodes and releases all dynamic memory.  Stack should
+ * @brief Clears all elements and releases all dynamic memory.  Stack should
  *        and able to be reused after clear
  * @param my_stack - pointer to the stack
  */
@@ -184,6 +197,7 @@ int sm_mult(struct stackm_t *my_stack);
  *        NOTE: this performs integer division
  *        NOTE: dividing by zero is not allowed and the function
  *              must return -1 (and do nothing) if the divisor is zero
+ *              (as must dividing the smallest int by -1, which overflows)
  *        The stack must contain at least 2 elements for this
  *        operation to be successful.
  *        Operation is TOS (top of stack) / 2nd from TOS
@@ -199,7 +213,7 @@ int sm_mult(struct stackm_t *my_stack);
  *        6 / 5 = 1
  * @param my_stack - pointer to the stack
  * @return -1 if the operation could not be performed
- *             (i.e. not enough elements on the stack)
+ *             (i.e. not enough elements on the stack or the divisor is zero)
  * @return 0 if operation was successful
  */
 int sm_div(struct stackm_t *my_stack);
@@ -223,7 +237,8 @@ int sm_div(struct stackm_t *my_stack);
  *        operation to be successful.
  *        'n' must be greater than or equal to 1.  A value of 0 or 1
  *        does nothing, but is still successful.
- *        Any removed element must be freed (no memory leaks)
+ *        Moves at most half of the stack (see the top of this file)
+ *        and does not allocate memory.
  * @param my_stack - pointer to the stack
  * @param depth - the depth of rotation
  * @return 0 if the rotate was completed successfully
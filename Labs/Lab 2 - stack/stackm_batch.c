@@ -0,0 +1,317 @@
+/**
+ * @file stackm_batch.c
+ *
+ * @brief Implementation of the batch stack machine declared in stackm_batch.h
+ */
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stackm_batch.h"
+
+// The column of slot i
+static int *column_at(struct stackm_batch_t *my_stack, int i)
+{
+    return my_stack->values + (size_t)i * my_stack->lanes;
+}
+
+// Kernels over one pair of columns, the result replaces the lower column.
+// The columns never overlap, which restrict tells the compiler so it can vectorize.
+
+static void add_columns(int *restrict below, const int *restrict top, int lanes)
+{
+    for (int i = 0; i < lanes; i++)
+    {
+        below[i] = top[i] + below[i];
+    }
+}
+
+static void sub_columns(int *restrict below, const int *restrict top, int lanes)
+{
+    for (int i = 0; i < lanes; i++)
+    {
+        below[i] = top[i] - below[i];
+    }
+}
+
+static void mult_columns(int *restrict below, const int *restrict top, int lanes)
+{
+    for (int i = 0; i < lanes; i++)
+    {
+        below[i] = top[i] * below[i];
+    }
+}
+
+static void div_columns(int *restrict below, const int *restrict top, unsigned char *restrict failed, int lanes)
+{
+    for (int i = 0; i < lanes; i++)
+    {
+        // Without branches, a failed lane divides by 1 and then takes 0
+        int divisor = below[i];
+        int bad = (divisor == 0) | ((top[i] == INT_MIN) & (divisor == -1));
+        int quotient = top[i] / (bad ? 1 : divisor);
+        below[i] = bad ? 0 : quotient;
+        failed[i] |= (unsigned char)bad;
+    }
+}
+
+int sm_batch_init(struct stackm_batch_t *my_stack, int lanes)
+{
+    my_stack->lanes = 0;
+    my_stack->size = 0;
+    my_stack->capacity = 0;
+    my_stack->values = NULL;
+    my_stack->failed = NULL;
+    if (lanes < 1)
+    {
+        return -1; // Invalid number of lanes
+    }
+
+    my_stack->failed = (unsigned char *)calloc(lanes, 1);
+    if (my_stack->failed == NULL)
+    {
+        return -1; // Memory allocation failure
+    }
+    my_stack->lanes = lanes;
+
+    return 0;
+}
+
+int sm_batch_size(struct stackm_batch_t *my_stack)
+{
+    return my_stack->size;
+}
+
+int sm_batch_reserve(struct stackm_batch_t *my_stack, int capacity)
+{
+    if (capacity <= my_stack->capacity)
+    {
+        return 0; // Already large enough
+    }
+
+    int new_capacity = my_stack->capacity == 0 ? SM_BATCH_INITIAL_CAPACITY : my_stack->capacity;
+    while (new_capacity < capacity)
+    {
+        if (new_capacity > INT_MAX / 2)
+        {
+            return -1; // Stack cannot grow any further
+        }
+        new_capacity *= 2;
+    }
+    if ((size_t)new_capacity > SIZE_MAX / sizeof(int) / my_stack->lanes)
+    {
+        return -1; // Stack cannot grow any further
+    }
+    int *values = (int *)realloc(my_stack->values, (size_t)new_capacity * my_stack->lanes * sizeof(int));
+    if (values == NULL)
+    {
+        return -1; // Memory allocation failure
+    }
+    my_stack->values = values;
+    my_stack->capacity = new_capacity;
+
+    return 0;
+}
+
+int sm_batch_push(struct stackm_batch_t *my_stack, const int *column)
+{
+    if (my_stack->size == my_stack->capacity && sm_batch_reserve(my_stack, my_stack->size + 1) != 0)
+    {
+        return -1; // Memory allocation failure
+    }
+
+    memcpy(column_at(my_stack, my_stack->size++), column, (size_t)my_stack->lanes * sizeof(int));
+
+    return 0; // Successful push
+}
+
+int sm_batch_push_value(struct stackm_batch_t *my_stack, int to_store)
+{
+    if (my_stack->size == my_stack->capacity && sm_batch_reserve(my_stack, my_stack->size + 1) != 0)
+    {
+        return -1; // Memory allocation failure
+    }
+
+    int *column = column_at(my_stack, my_stack->size++);
+    for (int i = 0; i < my_stack->lanes; i++)
+    {
+        column[i] = to_store;
+    }
+
+    return 0; // Successful push
+}
+
+int sm_batch_pop(struct stackm_batch_t *my_stack)
+{
+    if (my_stack->size == 0)
+    {
+        return -1; // Stack is empty
+    }
+
+    my_stack->size--;
+
+    return 0; // Successful pop
+}
+
+int sm_batch_top(struct stackm_batch_t *my_stack, int *to_store)
+{
+    if (my_stack->size == 0 || to_store == NULL)
+    {
+        return -1; // Stack is empty or to_store is NULL
+    }
+
+    memcpy(to_store, column_at(my_stack, my_stack->size - 1), (size_t)my_stack->lanes * sizeof(int));
+    return 0; // Successful top
+}
+
+void sm_batch_clear(struct stackm_batch_t *my_stack)
+{
+    // The columns are kept, the next batch of rows needs the same room
+    my_stack->size = 0;
+}
+
+void sm_batch_reset(struct stackm_batch_t *my_stack)
+{
+    my_stack->size = 0;
+    memset(my_stack->failed, 0, my_stack->lanes);
+}
+
+void sm_batch_destroy(struct stackm_batch_t *my_stack)
+{
+    free(my_stack->values);
+    free(my_stack->failed);
+    my_stack->lanes = 0;
+    my_stack->size = 0;
+    my_stack->capacity = 0;
+    my_stack->values = NULL;
+    my_stack->failed = NULL;
+}
+
+void sm_batch_print(struct stackm_batch_t *my_stack)
+{
+    if (my_stack->size == 0)
+    {
+        printf("\nStack is empty\n\n");
+        return;
+    }
+
+    printf("Stack Contents:\n");
+    for (int i = my_stack->size - 1; i >= 0; i--)
+    {
+        const int *column = column_at(my_stack, i);
+        for (int lane = 0; lane < my_stack->lanes; lane++)
+        {
+            if (my_stack->failed[lane])
+            {
+                printf(lane == 0 ? "?" : " ?");
+            }
+            else
+            {
+                printf(lane == 0 ? "%d" : " %d", column[lane]);
+            }
+        }
+
+        if (my_stack->size == 1)
+        {
+            printf("\t<-Top & Bottom");
+        }
+        else if (i == my_stack->size - 1)
+        {
+            printf("\t<-Top");
+        }
+        else if (i == 0)
+        {
+            printf("\t<-Bottom");
+        }
+        printf("\n");
+    }
+    printf("\n");
+}
+
+int sm_batch_add(struct stackm_batch_t *my_stack)
+{
+    if (my_stack->size < 2)
+    {
+        return -1; // Not enough slots on the stack
+    }
+
+    add_columns(column_at(my_stack, my_stack->size - 2), column_at(my_stack, my_stack->size - 1), my_stack->lanes);
+    my_stack->size--;
+
+    return 0;
+}
+
+int sm_batch_sub(struct stackm_batch_t *my_stack)
+{
+    if (my_stack->size < 2)
+    {
+        return -1; // Not enough slots on the stack
+    }
+
+    sub_columns(column_at(my_stack, my_stack->size - 2), column_at(my_stack, my_stack->size - 1), my_stack->lanes);
+    my_stack->size--;
+
+    return 0;
+}
+
+int sm_batch_mult(struct stackm_batch_t *my_stack)
+{
+    if (my_stack->size < 2)
+    {
+        return -1; // Not enough slots on the stack
+    }
+
+    mult_columns(column_at(my_stack, my_stack->size - 2), column_at(my_stack, my_stack->size - 1), my_stack->lanes);
+    my_stack->size--;
+
+    return 0;
+}
+
+int sm_batch_div(struct stackm_batch_t *my_stack)
+{
+    if (my_stack->size < 2)
+    {
+        return -1; // Not enough slots on the stack
+    }
+
+    div_columns(column_at(my_stack, my_stack->size - 2), column_at(my_stack, my_stack->size - 1), my_stack->failed,
+                my_stack->lanes);
+    my_stack->size--;
+
+    return 0;
+}
+
+int sm_batch_rotate(struct stackm_batch_t *my_stack, int depth)
+{
+    if (depth < 0)
+    {
+        return -1; // Invalid depth
+    }
+
+    if (depth <= 1)
+    {
+        // No rotation needed for depth less than or equal to 1
+        return 0;
+    }
+
+    if (depth > my_stack->size)
+    {
+        return -1; // Invalid depth
+    }
+
+    // As sm_rotate, with the spare slot above the top holding the saved column
+    if (my_stack->size == my_stack->capacity && sm_batch_reserve(my_stack, my_stack->size + 1) != 0)
+    {
+        return -1; // Memory allocation failure
+    }
+    size_t column_bytes = (size_t)my_stack->lanes * sizeof(int);
+    int *bottom = column_at(my_stack, my_stack->size - depth);
+    int *spare = column_at(my_stack, my_stack->size);
+    memcpy(spare, column_at(my_stack, my_stack->size - 1), column_bytes);
+    memmove(column_at(my_stack, my_stack->size - depth + 1), bottom, (depth - 1) * column_bytes);
+    memcpy(bottom, spare, column_bytes);
+
+    return 0; // Rotation successful
+}
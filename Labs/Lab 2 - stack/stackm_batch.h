@@ -0,0 +1,175 @@
+/**
+ * @file stackm_batch.h
+ *
+ * @brief External (public) declarations for a batch stack machine that
+ *        evaluates the same operations over many rows at once.
+ *
+ * Every slot of the stack holds a column of 'lanes' values, one per row,
+ * so a single call works on a whole batch of rows.  The arithmetic runs
+ * as plain loops over contiguous columns that the compiler turns into
+ * SIMD instructions (build with -O3, GCC only vectorizes these at -O2
+ * when it can see the number of lanes).
+ *
+ * Lanes never stop on their own.  A lane whose division fails (by zero,
+ * or INT_MIN / -1) keeps going with 0 as the quotient and is marked in
+ * 'failed', where sm_div would have failed.  The marks stay until
+ * sm_batch_reset, so the final values of a marked lane are meaningless.
+ */
+
+#ifndef STACKM_BATCH_H
+#define STACKM_BATCH_H
+
+#define SM_BATCH_INITIAL_CAPACITY 16 // Slots allocated by the first push
+
+/* Structures */
+
+/**
+ * @brief structure for a batch stack
+ * @property lanes - number of values in each slot (rows per batch)
+ * @property size - number of slots on the stack
+ * @property capacity - number of slots allocated
+ * @property values - the slots, bottom first, each a column of lanes values
+ * @property failed - one flag per lane, 1 if an operation failed in that lane
+ */
+struct stackm_batch_t
+{
+    int lanes;
+    int size;
+    int capacity;
+    int *values;
+    unsigned char *failed;
+};
+
+/* Batch Stack methods */
+
+/**
+ * @brief Initialize a batch stack structure as an empty stack.
+ * @param my_stack - a pointer to the structure to be init
+ * @param lanes - number of values in each slot (at least 1)
+ * @return -1 if lanes is invalid or memory could not be allocated
+ * @return 0 if the stack was init
+ */
+int sm_batch_init(struct stackm_batch_t *my_stack, int lanes);
+
+/**
+ * @brief Reports the number of slots on the stack.
+ * @param my_stack - pointer to the stack
+ * @return the size of the stack
+ */
+int sm_batch_size(struct stackm_batch_t *my_stack);
+
+/**
+ * @brief Make room for at least 'capacity' slots, as sm_reserve.
+ * @param my_stack - pointer to the stack
+ * @param capacity - the number of slots to make room for
+ * @return -1 if the memory could not be allocated
+ * @return 0 if the stack has room for capacity slots
+ */
+int sm_batch_reserve(struct stackm_batch_t *my_stack, int capacity);
+
+/**
+ * @brief Add a column to the top of the stack.
+ * @param my_stack - pointer to the stack
+ * @param column - lanes values, one per row
+ * @return -1 if push could not be performed (i.e. failed to allocate memory)
+ * @return 0 if push was successful
+ */
+int sm_batch_push(struct stackm_batch_t *my_stack, const int *column);
+
+/**
+ * @brief Add a slot holding the same value in every lane to the top of the stack.
+ * @param my_stack - pointer to the stack
+ * @param to_store - value for every lane
+ * @return -1 if push could not be performed (i.e. failed to allocate memory)
+ * @return 0 if push was successful
+ */
+int sm_batch_push_value(struct stackm_batch_t *my_stack, int to_store);
+
+/**
+ * @brief Removes the top slot.
+ * @param my_stack - pointer to the stack
+ * @return -1 if pop could not be performed (i.e stack is empty)
+ * @return 0 if pop was successful
+ */
+int sm_batch_pop(struct stackm_batch_t *my_stack);
+
+/**
+ * @brief Copies the top column.
+ * @param my_stack - pointer to the stack
+ * @param to_store - room for lanes values to contain the top column
+ * @return -1 if the stack is empty or to_store is NULL
+ * @return 0 if the column was copied
+ */
+int sm_batch_top(struct stackm_batch_t *my_stack, int *to_store);
+
+/**
+ * @brief Removes every slot.  The failed lanes stay marked.
+ * @param my_stack - pointer to the stack
+ */
+void sm_batch_clear(struct stackm_batch_t *my_stack);
+
+/**
+ * @brief Removes every slot and the failed marks, ready for the next batch of rows.
+ * @param my_stack - pointer to the stack
+ */
+void sm_batch_reset(struct stackm_batch_t *my_stack);
+
+/**
+ * @brief Releases all dynamic memory.  The stack must be init again before reuse.
+ * @param my_stack - pointer to the stack
+ */
+void sm_batch_destroy(struct stackm_batch_t *my_stack);
+
+/**
+ * @brief Print the stack as sm_print does, one slot per line with its lanes
+ *        separated by spaces.  Failed lanes are shown as '?'.
+ * @param my_stack - pointer to the stack
+ */
+void sm_batch_print(struct stackm_batch_t *my_stack);
+
+/**
+ * @brief sm_add in every lane: the top two slots are replaced by their sum.
+ * @param my_stack - pointer to the stack
+ * @return -1 if there are less than two slots on the stack (stack unchanged)
+ * @return 0 if successful
+ */
+int sm_batch_add(struct stackm_batch_t *my_stack);
+
+/**
+ * @brief sm_sub in every lane: the top two slots are replaced by the top
+ *        minus the slot below it.
+ * @param my_stack - pointer to the stack
+ * @return -1 if there are less than two slots on the stack (stack unchanged)
+ * @return 0 if successful
+ */
+int sm_batch_sub(struct stackm_batch_t *my_stack);
+
+/**
+ * @brief sm_mult in every lane: the top two slots are replaced by their product.
+ * @param my_stack - pointer to the stack
+ * @return -1 if there are less than two slots on the stack (stack unchanged)
+ * @return 0 if successful
+ */
+int sm_batch_mult(struct stackm_batch_t *my_stack);
+
+/**
+ * @brief sm_div in every lane: the top two slots are replaced by the top
+ *        divided by the slot below it.  Lanes dividing by zero or INT_MIN
+ *        by -1 get 0 and are marked in failed, the other lanes are unaffected.
+ * @param my_stack - pointer to the stack
+ * @return -1 if there are less than two slots on the stack (stack unchanged)
+ * @return 0 if successful, even if some lanes failed
+ */
+int sm_batch_div(struct stackm_batch_t *my_stack);
+
+/**
+ * @brief sm_rotate of whole slots.
+ * @param my_stack - pointer to the stack
+ * @param depth - the slot the top drops to
+ * @return -1 if depth is negative or larger than the stack, or memory could
+ *         not be allocated for the column being moved
+ * @return 0 if successful
+ */
+int sm_batch_rotate(struct stackm_batch_t *my_stack, int depth);
+
+#endif
@@ -0,0 +1,172 @@
+/**
+ * @file stackm_lf.c
+ *
+ * @brief Implementation of the lock-free stack declared in stackm_lf.h
+ */
+
+#include <stdlib.h>
+#include "stackm_lf.h"
+
+// Node number n lives in the segment of the highest set bit of n + SM_LF_SEGMENT_NODES
+static int segment_of(uint32_t number, uint32_t *offset)
+{
+    uint64_t n = (uint64_t)number + SM_LF_SEGMENT_NODES;
+    int segment = 63 - __builtin_clzll(n) - __builtin_ctz(SM_LF_SEGMENT_NODES);
+    *offset = (uint32_t)(n - ((uint64_t)SM_LF_SEGMENT_NODES << segment));
+    return segment;
+}
+
+static struct lf_node_t *node_at(struct stackm_lf_t *my_stack, uint32_t link)
+{
+    uint32_t offset;
+    int segment = segment_of(link - 1, &offset);
+    return &__atomic_load_n(&my_stack->segments[segment], __ATOMIC_ACQUIRE)[offset];
+}
+
+// The same link with a new tag, so a head that was changed and changed back no longer compares equal
+static uint64_t retag(uint64_t old, uint32_t link)
+{
+    return ((old >> 32) + 1) << 32 | link;
+}
+
+// Pop the first node of a list (top or free), returns its link or 0 if the list is empty
+static uint32_t take(struct stackm_lf_t *my_stack, uint64_t *head)
+{
+    uint64_t old = __atomic_load_n(head, __ATOMIC_ACQUIRE);
+    for (;;)
+    {
+        uint32_t link = (uint32_t)old;
+        if (link == 0)
+        {
+            return 0;
+        }
+        // The node may be taken and reused meanwhile, then next is stale but the tag check fails
+        uint32_t next = __atomic_load_n(&node_at(my_stack, link)->next, __ATOMIC_RELAXED);
+        if (__atomic_compare_exchange_n(head, &old, retag(old, next), 1, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+        {
+            return link;
+        }
+    }
+}
+
+// Push a node on a list (top or free)
+static void put(struct stackm_lf_t *my_stack, uint64_t *head, uint32_t link)
+{
+    struct lf_node_t *node = node_at(my_stack, link);
+    uint64_t old = __atomic_load_n(head, __ATOMIC_RELAXED);
+    do
+    {
+        __atomic_store_n(&node->next, (uint32_t)old, __ATOMIC_RELAXED);
+    } while (!__atomic_compare_exchange_n(head, &old, retag(old, link), 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+// Reuse a popped node or take a fresh one from the segments, returns its link or 0 if out of memory
+static uint32_t node_alloc(struct stackm_lf_t *my_stack)
+{
+    uint32_t link = take(my_stack, &my_stack->free);
+    if (link != 0)
+    {
+        return link;
+    }
+
+    uint32_t number = __atomic_fetch_add(&my_stack->next_node, 1, __ATOMIC_RELAXED);
+    uint32_t offset;
+    int segment = segment_of(number, &offset);
+    if (segment >= SM_LF_SEGMENTS)
+    {
+        return 0; // Every segment is full
+    }
+    if (__atomic_load_n(&my_stack->segments[segment], __ATOMIC_ACQUIRE) == NULL)
+    {
+        // The first thread to reach a segment installs it, the others discard their copy
+        struct lf_node_t *nodes =
+            (struct lf_node_t *)calloc((size_t)SM_LF_SEGMENT_NODES << segment, sizeof(struct lf_node_t));
+        if (nodes == NULL)
+        {
+            return 0; // Memory allocation failure
+        }
+        struct lf_node_t *expected = NULL;
+        if (!__atomic_compare_exchange_n(&my_stack->segments[segment], &expected, nodes, 0, __ATOMIC_RELEASE,
+                                         __ATOMIC_ACQUIRE))
+        {
+            free(nodes);
+        }
+    }
+    return number + 1;
+}
+
+void sm_lf_init(struct stackm_lf_t *my_stack)
+{
+    my_stack->top = 0;
+    my_stack->free = 0;
+    my_stack->next_node = 0;
+    for (int i = 0; i < SM_LF_SEGMENTS; i++)
+    {
+        my_stack->segments[i] = NULL;
+    }
+}
+
+int sm_lf_size(struct stackm_lf_t *my_stack)
+{
+    // Nodes are never freed so the walk is safe, but with other threads it may
+    // wander onto the free list, so it stops after every node was counted once
+    uint32_t limit = __atomic_load_n(&my_stack->next_node, __ATOMIC_RELAXED);
+    uint32_t size = 0;
+    uint32_t link = (uint32_t)__atomic_load_n(&my_stack->top, __ATOMIC_ACQUIRE);
+
+    while (link != 0 && size < limit)
+    {
+        size++;
+        link = __atomic_load_n(&node_at(my_stack, link)->next, __ATOMIC_RELAXED);
+    }
+
+    return (int)size;
+}
+
+int sm_lf_push(struct stackm_lf_t *my_stack, int to_store)
+{
+    uint32_t link = node_alloc(my_stack);
+    if (link == 0)
+    {
+        return -1; // Memory allocation failure
+    }
+
+    node_at(my_stack, link)->value = to_store;
+    put(my_stack, &my_stack->top, link);
+
+    return 0; // Successful push
+}
+
+int sm_lf_pop(struct stackm_lf_t *my_stack, int *to_store)
+{
+    uint32_t link = take(my_stack, &my_stack->top);
+    if (link == 0)
+    {
+        return -1; // Stack is empty
+    }
+
+    // The node is ours until it goes on the free list
+    if (to_store != NULL)
+    {
+        *to_store = node_at(my_stack, link)->value;
+    }
+    put(my_stack, &my_stack->free, link);
+
+    return 0; // Successful pop
+}
+
+void sm_lf_clear(struct stackm_lf_t *my_stack)
+{
+    while (sm_lf_pop(my_stack, NULL) == 0)
+    {
+    }
+}
+
+void sm_lf_destroy(struct stackm_lf_t *my_stack)
+{
+    for (int i = 0; i < SM_LF_SEGMENTS; i++)
+    {
+        free(my_stack->segments[i]);
+    }
+    sm_lf_init(my_stack);
+}
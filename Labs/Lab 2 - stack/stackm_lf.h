@@ -0,0 +1,112 @@
+/**
+ * @file stackm_lf.h
+ *
+ * @brief External (public) declarations for a lock-free stack that any
+ *        number of threads may push to and pop from at the same time.
+ *
+ * The top of the stack is changed with a single compare and swap
+ * (a Treiber stack), so no thread ever waits on a lock held by another.
+ *
+ * A link is a 32 bit node number plus a 32 bit tag that changes on every
+ * update, both packed into one 64 bit word.  A pop that read the top
+ * before another thread popped that node and pushed it again sees a
+ * different tag and retries, so the ABA problem cannot corrupt the stack.
+ *
+ * Nodes are never returned to the system while the stack is in use.
+ * Popped nodes go on a free list (itself a lock-free stack) and are
+ * reused by later pushes, so a thread still reading a node another
+ * thread just popped always reads valid memory.  The nodes live in
+ * segments that double in size, all released by sm_lf_destroy.
+ */
+
+#ifndef STACKM_LF_H
+#define STACKM_LF_H
+
+#include <stdint.h>
+
+#define SM_LF_SEGMENTS 24 // Segment i holds SM_LF_SEGMENT_NODES << i nodes
+#define SM_LF_SEGMENT_NODES 64
+
+/* Structures */
+
+/**
+ * @brief lock-free stack node
+ * @property value - the value of the stack element
+ * @property next - node number (plus one) of the node below it, 0 for none
+ */
+struct lf_node_t
+{
+    int value;
+    uint32_t next;
+};
+
+/**
+ * @brief structure for a lock-free stack
+ * @property top - tagged link of the top node
+ * @property free - tagged link of the first reusable node
+ * @property next_node - number of nodes ever taken from the segments
+ * @property segments - the node storage, allocated as it is needed
+ */
+struct stackm_lf_t
+{
+    uint64_t top;
+    uint64_t free;
+    uint32_t next_node;
+    struct lf_node_t *segments[SM_LF_SEGMENTS];
+};
+
+/* Lock-free Stack methods
+ *
+ * Every method except sm_lf_init and sm_lf_destroy may be called by
+ * several threads at once on the same stack.
+ */
+
+/**
+ * @brief Initialize a lock-free stack structure.
+ * @param my_stack - a pointer to the structure to be init
+ */
+void sm_lf_init(struct stackm_lf_t *my_stack);
+
+/**
+ * @brief Reports the current size of the stack.
+ *        Must iterate the stack to get this data size there is no size property.
+ *        While other threads push or pop the value is only an estimate.
+ * @param my_stack - pointer to the stack
+ * @return the size of the stack
+ */
+int sm_lf_size(struct stackm_lf_t *my_stack);
+
+/**
+ * @brief Add a new node with provided data to the top of the stack.
+ * @param my_stack - pointer to the stack
+ * @param to_store - value to push on the stack
+ * @return -1 if push could not be performed (i.e. failed to allocate memory)
+ * @return 0 if push was successful
+ */
+int sm_lf_push(struct stackm_lf_t *my_stack, int to_store);
+
+/**
+ * @brief Removes the top item in the stack and "returns" its value.
+ *        Unlike sm_pop the value is handed back, another thread could
+ *        change the top between a separate top and pop.
+ * @param my_stack - pointer to the stack
+ * @param to_store - pointer to an integer to contain the popped value (may be NULL)
+ * @return -1 if pop could not be performed (i.e stack is empty)
+ * @return 0 if pop was successful
+ */
+int sm_lf_pop(struct stackm_lf_t *my_stack, int *to_store);
+
+/**
+ * @brief Pops every element.  The nodes are kept for reuse.
+ * @param my_stack - pointer to the stack
+ */
+void sm_lf_clear(struct stackm_lf_t *my_stack);
+
+/**
+ * @brief Releases all dynamic memory.  The stack must be init again before reuse.
+ *        NOTE: no other thread may be using the stack
+ * @param my_stack - pointer to the stack
+ */
+void sm_lf_destroy(struct stackm_lf_t *my_stack);
+
+#endif
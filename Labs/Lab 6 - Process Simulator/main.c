@@ -27,14 +27,17 @@ typedef struct
     int start_io_wait_time;
     int io_wait_time;
     bool io_pending;
+    int ready_order; // When it entered the ready queue, equal priorities run first come first served
 } Process;
 
-Process processes[MAX_PROCESSES];        
+Process processes[MAX_PROCESSES];        // Ready queue, a binary max-heap on (priority, ready_order)
 Process all_processes[MAX_PROCESSES];    
 int num_processes = 0;                  
 int front = 0;                           // Front of the queue
 int rear = -1;                           // Rear of the queue
-int count = 0;                           // Number of elements in the queue
+int count = 0;                           // Number of processes started and not yet ended
+int ready_count = 0;                     // Number of processes in the ready queue
+int next_ready_order = 0;                // ready_order of the next process to be enqueued
 bool preemptive_scheduler = false;       // Flag for preemptive scheduling
 int current_time = 0;                    
 int idle_time = 0;                       
@@ -45,6 +48,7 @@ Process running_process;
 Process io_processes[MAX_IO_DEVICES];    // Array to store processes waiting for I/O
 int io_process_count = 0;                // Number of processes waiting for I/O
 
+bool runsBefore(Process *first, Process *second);
 void enqueue(Process process);
 Process dequeue();
 bool isQueueEmpty();
@@ -133,70 +137,63 @@ int main(int argc, char *argv[])
     return 0;
 }
 
-void enqueue(Process process)
+bool runsBefore(Process *first, Process *second)
 {
-    if (!isQueueEmpty())
+    // Higher priority first, then whichever entered the ready queue earlier
+    if (first->priority != second->priority)
     {
-        int i = 0;
-        for (i = 0; i < count; i++)
-        {
-            if (process.priority < processes[i].priority)
-            {
-                break;
-            }
-        }
-        for (int j = count; j > i; j--)
-        {
-            processes[j] = processes[j - 1];
-        }
-        processes[i] = process;
-        count++;
+        return first->priority > second->priority;
     }
-    else
+    return first->ready_order < second->ready_order;
+}
+
+void enqueue(Process process)
+{
+    process.ready_order = next_ready_order++;
+
+    // sift the new process up from the bottom of the heap, O(log n)
+    int i = ready_count++;
+    while (i > 0 && runsBefore(&process, &processes[(i - 1) / 2]))
     {
-        processes[0] = process;
-        count++;
+        processes[i] = processes[(i - 1) / 2];
+        i = (i - 1) / 2;
     }
+    processes[i] = process;
 }
 
 Process dequeue()
 {
-    if (!isQueueEmpty())
+    if (isQueueEmpty())
     {
-        // loop through processes array to find the process with the highest priority
-        Process highest_priority_process = processes[0];
-        int highest_priority_process_index = 0;
-        for (int i = 1; i < count; i++)
+        // nothing ready, the CPU goes idle
+        return (Process){.pid = 0};
+    }
+
+    // the root runs next, the last process sifts down from the root to fill its place, O(log n)
+    Process highest_priority_process = processes[0];
+    Process last = processes[--ready_count];
+    int i = 0;
+    while (2 * i + 1 < ready_count)
+    {
+        int child = 2 * i + 1;
+        if (child + 1 < ready_count && runsBefore(&processes[child + 1], &processes[child]))
         {
-            if (processes[i].priority > highest_priority_process.priority)
-            {
-                highest_priority_process = processes[i];
-                highest_priority_process_index = i;
-            }
+            child++;
         }
-        // shift elements to the left
-        for (int i = highest_priority_process_index; i < count - 1; i++)
+        if (!runsBefore(&processes[child], &last))
         {
-            processes[i] = processes[i + 1];
+            break;
         }
-        count--;
-        return highest_priority_process;
+        processes[i] = processes[child];
+        i = child;
     }
+    processes[i] = last;
+    return highest_priority_process;
 }
 
 bool isQueueEmpty()
 {
-    // loop through processes array to check if there are no processes
-    bool empty = true;
-    for (int i = 0; i < MAX_PROCESSES; i++)
-    {
-        if (processes[i].pid != 0)
-        {
-            empty = false;
-            break;
-        }
-    }
-    return empty;
+    return ready_count == 0;
 }
 
 void handleProcessStart(int priority)
@@ -252,6 +249,12 @@ void handleProcessStart(int priority)
 
 void handleIORequest(int io_device)
 {
+    if (running_process.pid == 0)
+    {
+        // the CPU is idle, no process can be waiting on this request
+        return;
+    }
+
     // Update process information
     running_process.io_device = io_device;
     running_process.io_pending = true;
@@ -261,6 +264,12 @@ void handleIORequest(int io_device)
 
     // add process to io_processes array
     io_processes[io_device - 1] = running_process;
+    if (isQueueEmpty())
+    {
+        // nothing ready, leave the CPU idle
+        running_process = (Process){.pid = 0};
+        return;
+    }
     running_process = dequeue();
     running_process.ready_wait_time += current_time - running_process.start_ready_wait_time;
     printf("%d: Starting process with PID: %d PRIORITY: %d\n", current_time, running_process.pid, running_process.priority);
@@ -297,6 +306,12 @@ void handleIOEnd(int io_device)
 
 void handleProcessEnd()
 {
+    if (running_process.pid == 0)
+    {
+        // the CPU is idle, there is no process to end
+        return;
+    }
+
     // Update process information
     process_completion_count++;
 
@@ -306,14 +321,15 @@ void handleProcessEnd()
 
     count--;
 
-    // Dequeue the completed process
-    running_process = dequeue();
-    running_process.ready_wait_time += current_time - running_process.start_ready_wait_time;
-
-    if (running_process.pid != 0)
+    // Schedule the next ready process, or leave the CPU idle
+    if (isQueueEmpty())
     {
-        printf("%d: Process scheduled to run with PID: %d PRIORITY: %d\n", current_time, running_process.pid, running_process.priority);
+        running_process = (Process){.pid = 0};
+        return;
     }
+    running_process = dequeue();
+    running_process.ready_wait_time += current_time - running_process.start_ready_wait_time;
+    printf("%d: Process scheduled to run with PID: %d PRIORITY: %d\n", current_time, running_process.pid, running_process.priority);
 }
 
 void printStatistics()
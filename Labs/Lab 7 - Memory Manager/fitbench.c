@@ -0,0 +1,121 @@
+/**
+ * @file fitbench.c
+ *
+ * @brief Compares the placement algorithms (first, next, best and worst fit)
+ *        by replaying the same random allocate/free workload against each one
+ *        and reporting search lengths and fragmentation (external fragmentation is
+ *        1 - largest free block / free bytes at the end of the run)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "memory_manager.h"
+
+#define HEAP_SIZE (1 << 20)
+#define MAX_LIVE 2560
+#define DEFAULT_OPS 200000
+
+typedef void *(*malloc_function)(int nbytes);
+
+typedef struct
+{
+    const char *name;
+    malloc_function allocate;
+} Strategy;
+
+static Strategy strategies[] = {
+    {"first fit", mymalloc_ff},
+    {"next fit", mymalloc_nf},
+    {"best fit", mymalloc_bf},
+    {"worst fit", mymalloc_wf},
+};
+
+/**
+ * @brief Request sizes: mostly small objects with the occasional large buffer
+ * @param seed - the generator state
+ * @return the size of the next request
+ */
+static int next_size(unsigned int *seed)
+{
+    if (rand_r(seed) % 10 == 0)
+    {
+        return 512 + rand_r(seed) % 4096;
+    }
+    return 8 + rand_r(seed) % 120;
+}
+
+/**
+ * @brief Replay the workload with one placement algorithm and print a result row
+ * @param strategy - the placement algorithm to measure
+ * @param ops - the number of allocate/free operations
+ */
+static void run(Strategy *strategy, int ops)
+{
+    static void *live[MAX_LIVE];
+    static char heap[HEAP_SIZE];
+    unsigned int seed = 42;
+    int live_count = 0;
+    int failures = 0;
+    int peak_fragments = 0;
+    long long fragment_sum = 0;
+
+    mm_init(heap, HEAP_SIZE);
+    for (int i = 0; i < ops; i++)
+    {
+        // Keep the heap busy: allocate until it is mostly full, then mix in frees
+        if (live_count == MAX_LIVE || (live_count > 0 && rand_r(&seed) % 100 < 45))
+        {
+            int k = rand_r(&seed) % live_count;
+            myfree(live[k]);
+            live[k] = live[--live_count];
+        }
+        else
+        {
+            void *ptr = strategy->allocate(next_size(&seed));
+            if (ptr == NULL)
+            {
+                failures++;
+            }
+            else
+            {
+                live[live_count++] = ptr;
+            }
+        }
+
+        int fragments = get_fragment_count();
+        fragment_sum += fragments;
+        if (fragments > peak_fragments)
+        {
+            peak_fragments = fragments;
+        }
+    }
+
+    struct mm_stats stats;
+    mm_get_stats(&stats);
+    printf("%-10s %12.2f %10d %10.1f %10d %12d %10.3f\n", strategy->name,
+           stats.malloc_count > 0 ? (double)get_search_steps() / stats.malloc_count : 0.0, failures,
+           (double)fragment_sum / ops, peak_fragments, stats.free_bytes, stats.external_fragmentation);
+    mm_destroy();
+}
+
+/**
+ * @brief Program entry procedure - runs every placement algorithm on the same workload
+ * @param argc - the number of arguments
+ * @param argv - optional number of operations
+ * @return 0
+ */
+int main(int argc, char *argv[])
+{
+    int ops = argc > 1 ? atoi(argv[1]) : DEFAULT_OPS;
+
+    printf("%d operations on a %d byte heap\n", ops, HEAP_SIZE);
+    printf("%-10s %12s %10s %10s %10s %12s %10s\n", "strategy", "steps/alloc", "failures", "avg frags",
+           "peak frags", "free bytes", "ext frag");
+    for (int i = 0; i < (int)(sizeof(strategies) / sizeof(strategies[0])); i++)
+    {
+        run(&strategies[i], ops);
+    }
+    return 0;
+}
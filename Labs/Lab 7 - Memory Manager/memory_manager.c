@@ -9,332 +9,3520 @@
  * Name: Hudson Arney
  */
 
+#define _GNU_SOURCE // sched_getcpu, MAP_HUGETLB
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
 #include "memory_manager.h"
 
+// Data Structure for Memory Block
+typedef struct Node
+{
+    void *start;             // Start address of the block
+    int size;                // Size of the block
+    int allocated;           // Flag indicating if the block is allocated
+    struct Node *next;       // Pointer to the next block in the list
+    struct Node *prev;       // Pointer to the previous block in the list
+    struct Node *hash_next;  // Next allocated block in the same hash bucket
+    unsigned int serial;     // Changes every time the block is freed
+    int cached;              // Flag indicating the block sits in a thread cache
+    int quick;               // Flag indicating the block sits on a quick list
+    struct Node *quick_next; // Next block on the same quick list
+    mm_handle_t *handle;     // Handle of a relocatable block (NULL if the block cannot move)
+
+    // Free block index links (only used while the block is free)
+    struct Node *addr_left;  // Address tree - lower addresses
+    struct Node *addr_right; // Address tree - higher addresses
+    int max_free;            // Largest free block in this address subtree
+    struct Node *size_left;  // Size tree - smaller (size, start)
+    struct Node *size_right; // Size tree - larger (size, start)
+    unsigned int priority;   // Treap priority shared by both trees
+} Node;
+
+/*
+ * Nodes are carved out of slabs owned by the memory manager instead of being
+ * malloc'd one at a time.  Released nodes are kept on free_nodes (linked
+ * through next) and reused, so after mm_init the system allocator is only
+ * called again if the number of blocks grows past every earlier peak.
+ */
+#define MIN_SLAB_NODES 64
+#define MAX_SLAB_NODES 65536
+typedef struct NodeSlab
+{
+    struct NodeSlab *next; // Next slab owned by the arena
+    Node nodes[];          // Nodes carved out of this slab
+} NodeSlab;
+
+/*
+ * Allocated blocks are found by address through a chained hash table so
+ * myfree does not have to walk memory_list.  The bucket count is fixed
+ * when the manager is initialized (roughly one bucket per 64 bytes managed).
+ */
+#define MIN_HASH_BITS 4
+#define MAX_HASH_BITS 20
+
+/*
+ * The managed space is split into one or more arenas, each covering its own
+ * address range with its own lock, block list, free index and node pool.
+ * Threads allocate from a home arena and only move on to the others when it
+ * cannot satisfy a request, frees go back to the arena owning the address.
+ *
+ * Free blocks of an arena are also indexed by two treaps kept alongside
+ * memory_list:
+ *   addr_root - keyed by start address, every node also records the largest
+ *               free block in its subtree so first and worst fit can descend
+ *               straight to their answer
+ *   size_root - keyed by (size, start) so best fit is a lower bound search
+ * Ties are broken by address, so the answers match a front to back walk
+ * of memory_list while costing O(log n) instead of O(n).
+ *
+ * Next fit resumes from rover, the block its previous search settled on.
+ * Nodes are only released when they merge into their predecessor, so
+ * node_release moves the rover back onto the surviving block.
+ *
+ * With lazy coalescing on (quick_limit > 0) small freed blocks are not
+ * merged but pushed on quick_lists, one LIFO list per QUICK_GRANULE of
+ * size, and handed straight back out to requests of the same size.  They
+ * stay allocated as far as their neighbours are concerned.  consolidate
+ * merges them all into the free index in one pass once more than
+ * quick_limit are waiting or a placement search fails.
+ */
+#define QUICK_GRANULE 16
+#define QUICK_LISTS 32
+#define QUICK_MAX (QUICK_GRANULE * QUICK_LISTS) // Largest block kept on a quick list
+
+typedef struct Arena
+{
+    pthread_mutex_t lock;           // Guards everything below
+    char *start;                    // First byte managed by the arena
+    int size;                       // Number of bytes managed by the arena
+    Node *memory_list;              // Blocks in address order
+    Node *addr_root;                // Free blocks by address
+    Node *size_root;                // Free blocks by (size, address)
+    Node **hash_table;              // Allocated blocks by address
+    int hash_bits;                  // log2 of the hash table size
+    NodeSlab *node_slabs;           // Slabs backing the nodes
+    Node *free_nodes;               // Nodes ready for reuse
+    int slab_nodes;                 // Nodes in the next slab
+    unsigned int priority_seed;     // Treap priority generator state
+    Node *rover;                    // Where the next fit search resumes
+    Node *quick_lists[QUICK_LISTS]; // Freed blocks waiting to be merged, by size
+    int quick_limit;                // Quick list blocks that trigger a consolidation (0 merges on every free)
+    char *compact_from;             // Where the next compaction step resumes
+    int commit_chunk;               // Granularity of committing mapped memory (0 if the caller provided it)
+    int committed;                  // Bytes from start that are backed by readable and writable pages
+
+    // Statistics, only written under the lock but readable at any time
+    int allocated_bytes;                  // Sum of allocated block sizes
+    int free_bytes;                       // Sum of free block sizes
+    int fragment_count;                   // Number of free blocks
+    int largest_free;                     // Largest free block (max_free of the address tree root)
+    int quick_count;                      // Number of blocks on the quick lists
+    int free_histogram[MM_STATS_BUCKETS]; // Free blocks by log2 of their size
+    long long search_steps;               // Free index nodes examined by placement searches
+    long long splits;                     // Blocks split in two
+    long long merges;                     // Free blocks merged into a neighbour
+    long long relocations;                // Blocks moved by compaction
+    long long trimmed_bytes;              // Bytes of idle pages returned to the system
+} Arena;
+
+/*
+ * Per-thread caches of freed blocks.  A thread keeps recently freed blocks
+ * in bins of equal sized blocks and hands them straight back out without
+ * taking an arena lock.  Cached blocks stay allocated as far as the arenas
+ * are concerned, so tcache_limit bounds how many bytes each thread may hold.
+ * Every thread has a separate cache for each heap it allocates from, found
+ * through the heap's thread specific key.
+ *
+ * A thread can only find the block behind a pointer it allocated itself
+ * (the owned table), each entry is validated against the block's serial so
+ * a block freed by another thread is never mistaken for a cached one.
+ * Anything the cache cannot handle takes the normal locked path.
+ */
+#define TCACHE_BINS 16       // Distinct block sizes cached per thread
+#define TCACHE_BIN_BLOCKS 8  // Blocks held per bin
+#define TCACHE_BATCH 4       // Blocks moved per refill or flush
+#define TCACHE_OWNED_BITS 7  // Owned table holds 2^bits pointers
+
+typedef struct TCacheBin
+{
+    int size;                        // Size of every block in the bin
+    int count;                       // Number of cached blocks
+    Node *blocks[TCACHE_BIN_BLOCKS]; // Cached blocks, oldest first
+} TCacheBin;
+
+typedef struct TCacheEntry
+{
+    void *start;         // Pointer handed out by this thread
+    Node *block;         // Block behind the pointer
+    unsigned int serial; // Block serial when the pointer was handed out
+} TCacheEntry;
+
+typedef struct TCache
+{
+    mm_heap_t *heap;     // Heap the cache belongs to
+    struct TCache *next; // Next cache of the same heap
+    struct TCache *prev; // Previous cache of the same heap
+    int cached_bytes;    // Bytes held in the bins
+    TCacheBin bins[TCACHE_BINS];
+    TCacheEntry owned[1 << TCACHE_OWNED_BITS];
+} TCache;
+
+/*
+ * Buddy zone.  A power of two sized block is carved out of the arenas and
+ * managed as a binary buddy system.  Blocks of the zone form an implicit
+ * binary tree (root = whole zone, index 0, children of i are 2i+1 and 2i+2)
+ * tracked by two bitmaps: split (the node was divided into its two buddies)
+ * and allocated.  Free blocks are kept on one doubly linked list per order,
+ * the links live inside the free blocks themselves.  Splitting and merging
+ * walk at most one path of the tree, so both are O(log n).
+ */
+#define BUDDY_MIN_ORDER 4 // Smallest buddy block is 16 bytes
+#define BUDDY_MAX_ORDER 30
+#define BUDDY_ALIGNMENT 16
+
+typedef struct BuddyBlock
+{
+    struct BuddyBlock *next; // Next free block of the same order
+    struct BuddyBlock *prev; // Previous free block of the same order
+} BuddyBlock;
+
+typedef struct BuddyZone
+{
+    pthread_mutex_t lock;                       // Guards everything below
+    char *start;                                // First byte of the zone (NULL if there is none)
+    int order;                                  // The zone holds 2^order bytes
+    int zone_bytes;                             // Bytes counted by the buddy statistics
+    BuddyBlock *free_lists[BUDDY_MAX_ORDER + 1]; // Free blocks by order
+    unsigned char *split;                       // Bitmap of split tree nodes
+    unsigned char *allocated;                   // Bitmap of allocated tree nodes
+
+    // Statistics, only written under the lock but readable at any time
+    int allocated_bytes;                 // Sum of allocated buddy block sizes
+    int free_bytes;                      // Sum of free buddy block sizes
+    int fragment_count;                  // Number of free buddy blocks
+    int free_counts[BUDDY_MAX_ORDER + 1]; // Free blocks by order
+    long long splits;                    // Blocks split into two buddies
+    long long merges;                    // Buddies merged back together
+} BuddyZone;
+
+/*
+ * Fixed size object pools.  A pool is one contiguous slab allocated from
+ * the arenas.  The slab starts with the pool descriptor and a bitmap of
+ * live objects, followed by the objects themselves.  Free objects are
+ * chained through their first bytes, so allocating and freeing are O(1).
+ */
+#define POOL_ALIGNMENT 16
+
+struct mm_pool
+{
+    mm_heap_t *heap;         // Heap the slab was allocated from
+    pthread_mutex_t lock;    // Guards everything below
+    void *slab;              // Block allocated from the arenas
+    char *objects;           // First object
+    int obj_size;            // Object size rounded up to POOL_ALIGNMENT
+    int count;               // Number of objects in the slab
+    int live;                // Number of allocated objects
+    void *free_list;         // Free objects, linked through their first bytes
+    unsigned char *live_map; // Bitmap of allocated objects
+};
+
+/*
+ * Mapped heaps (see mm_init_mapped) reserve address space up front and
+ * commit it in chunks as the blocks handed out reach further into it.  Free
+ * space at the end of an arena is given back once it spans more than
+ * TRIM_KEEP_CHUNKS chunks, so the resident size follows the heap's use.
+ * Blocks are described by out of line nodes, so the manager itself never
+ * touches memory that has not been handed out.
+ */
+#define MAP_CHUNK (256 * 1024)             // Commit granularity with normal pages
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)   // Commit granularity (and alignment) with huge pages
+#define TRIM_KEEP_CHUNKS 2                 // Committed free chunks kept at the end of an arena
+
+/*
+ * Relocatable allocations.  A handle records where its block currently
+ * lives, the block's node points back at the handle.  While a handle is
+ * not pinned compaction may slide its block down over the free block in
+ * front of it.  Handles are carved out of slabs owned by the heap, like
+ * the nodes are.
+ */
+#define HANDLE_SLAB_HANDLES 256
+
+struct mm_handle
+{
+    void *ptr;              // Current start of the block (changes while unpinned)
+    int size;               // Requested size
+    int pins;               // Outstanding mm_pin calls, guarded by the arena lock
+    Arena *arena;           // Arena holding the block (never changes)
+    mm_heap_t *heap;        // Heap the handle belongs to
+    struct mm_handle *next; // Next unused handle
+};
+
+typedef struct HandleSlab
+{
+    struct HandleSlab *next; // Next slab owned by the heap
+    struct mm_handle handles[HANDLE_SLAB_HANDLES];
+} HandleSlab;
+
+/*
+ * A heap is one managed region with its own arenas, buddy zone, statistics
+ * and thread caches, so independent heaps never contend for a lock.  The
+ * functions without a heap argument operate on default_heap (see mm_init).
+ */
+struct mm_heap
+{
+    Arena *arenas;   // Arenas in address order (NULL if not initialized)
+    int arena_count; // Number of arenas
+    int arena_span;  // Bytes covered by every arena but the last
+    int assignment;  // MM_ARENA_ROUND_ROBIN or MM_ARENA_BY_CPU
+    BuddyZone buddy; // Zone of the buddy allocator
+
+    pthread_mutex_t lock;    // Guards caches, the handle slabs and the compaction position
+    pthread_key_t cache_key; // Cache of the calling thread
+    bool has_cache_key;      // Set if cache_key could be created
+    TCache *caches;          // Cache of every thread that allocated from the heap
+    int tcache_limit;        // Bytes each thread may cache (0 disables the caches)
+    int quick_limit;         // Quick list limit of every arena (0 disables lazy coalescing)
+
+    HandleSlab *handle_slabs;  // Slabs backing the handles
+    mm_handle_t *free_handles; // Handles ready for reuse
+    int compact_arena;         // Arena the current compaction pass is working on
+    void *map_base;            // Mapping reserved by mm_init_mapped (NULL if the caller provided the memory)
+    size_t map_bytes;          // Length of the mapping
+
+    // Statistics, counters shared by threads are updated with atomic adds
+    int malloc_count;                    // Successful allocations
+    long long call_counts[MM_TRACE_OPS]; // Public calls by MM_TRACE_* operation
+    int pool_slab_bytes;                 // Object bytes of every pool slab
+    int pool_allocated_bytes;            // Object bytes handed out by pools
+};
+
 /*
  * Using static causes the compiler to
  * limit visibility of the variables to this file only
  * This can be used to simulate 'private' variables in c
  */
-static int allocation_count = 0;
-static int malloc_count = 0;
+static mm_heap_t default_heap = {.buddy = {.lock = PTHREAD_MUTEX_INITIALIZER}, .lock = PTHREAD_MUTEX_INITIALIZER};
+static int next_home_ticket = 0;        // Tickets handed out to threads
+static __thread int home_ticket = -1;   // Picks the home arena of the thread (round robin)
+
+/*
+ * Allocation trace recording.  While a recording is running every public
+ * allocation and free appends a struct mm_trace_record to a ring owned by
+ * the calling thread.  Only the owner moves head and only the flusher
+ * thread moves tail, so recording takes no lock.  The flusher writes the
+ * rings to the trace file every TRACE_FLUSH_MS, a record that finds its
+ * ring full is dropped (and counted) instead of stalling the allocation.
+ *
+ * Rings are never freed: a thread that exits gives its ring up and the
+ * next new thread adopts it, so a slow writer can never touch freed memory.
+ */
+#define TRACE_RING_RECORDS 16384 // Records buffered per thread (512KB)
+#define TRACE_FLUSH_MS 2         // Flusher wake up interval
+
+typedef struct TraceRing
+{
+    struct mm_trace_record records[TRACE_RING_RECORDS];
+    unsigned int head;      // Next record to write (owning thread)
+    unsigned int tail;      // Next record to flush (flusher)
+    int busy;               // Set while the owner is writing a record
+    int owned;              // Set while a live thread owns the ring
+    unsigned int thread;    // Identifier written into the records
+    struct TraceRing *next; // Next ring ever created
+} TraceRing;
+
+static TraceRing *trace_rings = NULL;                          // Every ring ever created
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER; // Serializes start and stop
+static int trace_active = 0;                                   // Set while recording
+static FILE *trace_file = NULL;
+static pthread_t trace_flusher;
+static long long trace_epoch = 0;      // Clock reading the timestamps are relative to
+static long long trace_dropped = 0;    // Records lost to full rings
+static unsigned int trace_threads = 0; // Thread identifiers handed out
+static pthread_once_t trace_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t trace_key;
+static __thread TraceRing *trace_ring = NULL;
+
+// Placement algorithm used by an allocation (first, best or worst fit)
+typedef Node *(*fit_function)(Arena *arena, int nbytes, int alignment);
+
+/*
+ * Arena statistics are updated incrementally on every allocation, split,
+ * free and merge while the arena lock is held.  The new values are
+ * published with relaxed atomic stores so the get_* functions can poll
+ * them without taking any lock or walking memory_list.
+ */
+static void stat_add(int *counter, int delta)
+{
+    __atomic_store_n(counter, *counter + delta, __ATOMIC_RELAXED);
+}
+
+static int stat_read(int *counter)
+{
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+static void stat_add_long(long long *counter, long long delta)
+{
+    __atomic_store_n(counter, *counter + delta, __ATOMIC_RELAXED);
+}
+
+static long long stat_read_long(long long *counter)
+{
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+// Histogram bucket of a free block
+static int size_bucket(int size)
+{
+    if (size <= 1)
+    {
+        return 0;
+    }
+    int bucket = 31 - __builtin_clz((unsigned int)size);
+    return bucket < MM_STATS_BUCKETS ? bucket : MM_STATS_BUCKETS - 1;
+}
+
+// Xorshift generator for treap priorities
+static unsigned int next_priority(Arena *arena)
+{
+    arena->priority_seed ^= arena->priority_seed << 13;
+    arena->priority_seed ^= arena->priority_seed >> 17;
+    arena->priority_seed ^= arena->priority_seed << 5;
+    return arena->priority_seed;
+}
+
+static int addr_max(Node *t)
+{
+    return t == NULL ? -1 : t->max_free;
+}
+
+static void addr_update(Node *t)
+{
+    t->max_free = t->size;
+    if (addr_max(t->addr_left) > t->max_free)
+    {
+        t->max_free = addr_max(t->addr_left);
+    }
+    if (addr_max(t->addr_right) > t->max_free)
+    {
+        t->max_free = addr_max(t->addr_right);
+    }
+}
+
+// Split an address tree into blocks below key and blocks at or above key
+static void addr_split(Node *t, void *key, Node **lower, Node **upper)
+{
+    if (t == NULL)
+    {
+        *lower = NULL;
+        *upper = NULL;
+    }
+    else if ((char *)t->start < (char *)key)
+    {
+        addr_split(t->addr_right, key, &t->addr_right, upper);
+        addr_update(t);
+        *lower = t;
+    }
+    else
+    {
+        addr_split(t->addr_left, key, lower, &t->addr_left);
+        addr_update(t);
+        *upper = t;
+    }
+}
+
+// Join two address trees where every block in lower precedes every block in upper
+static Node *addr_join(Node *lower, Node *upper)
+{
+    if (lower == NULL)
+    {
+        return upper;
+    }
+    if (upper == NULL)
+    {
+        return lower;
+    }
+    if (lower->priority > upper->priority)
+    {
+        lower->addr_right = addr_join(lower->addr_right, upper);
+        addr_update(lower);
+        return lower;
+    }
+    upper->addr_left = addr_join(lower, upper->addr_left);
+    addr_update(upper);
+    return upper;
+}
+
+static Node *addr_insert(Node *t, Node *block)
+{
+    if (t == NULL || block->priority > t->priority)
+    {
+        addr_split(t, block->start, &block->addr_left, &block->addr_right);
+        addr_update(block);
+        return block;
+    }
+    if ((char *)block->start < (char *)t->start)
+    {
+        t->addr_left = addr_insert(t->addr_left, block);
+    }
+    else
+    {
+        t->addr_right = addr_insert(t->addr_right, block);
+    }
+    addr_update(t);
+    return t;
+}
+
+static Node *addr_remove(Node *t, Node *block)
+{
+    if (t == block)
+    {
+        return addr_join(t->addr_left, t->addr_right);
+    }
+    if ((char *)block->start < (char *)t->start)
+    {
+        t->addr_left = addr_remove(t->addr_left, block);
+    }
+    else
+    {
+        t->addr_right = addr_remove(t->addr_right, block);
+    }
+    addr_update(t);
+    return t;
+}
+
+// Ordering used by the size tree, equal sizes are ordered by address
+static bool size_less(Node *a, Node *b)
+{
+    return a->size < b->size || (a->size == b->size && (char *)a->start < (char *)b->start);
+}
+
+static void size_split(Node *t, Node *key, Node **lower, Node **upper)
+{
+    if (t == NULL)
+    {
+        *lower = NULL;
+        *upper = NULL;
+    }
+    else if (size_less(t, key))
+    {
+        size_split(t->size_right, key, &t->size_right, upper);
+        *lower = t;
+    }
+    else
+    {
+        size_split(t->size_left, key, lower, &t->size_left);
+        *upper = t;
+    }
+}
+
+static Node *size_join(Node *lower, Node *upper)
+{
+    if (lower == NULL)
+    {
+        return upper;
+    }
+    if (upper == NULL)
+    {
+        return lower;
+    }
+    if (lower->priority > upper->priority)
+    {
+        lower->size_right = size_join(lower->size_right, upper);
+        return lower;
+    }
+    upper->size_left = size_join(lower, upper->size_left);
+    return upper;
+}
+
+static Node *size_insert(Node *t, Node *block)
+{
+    if (t == NULL || block->priority > t->priority)
+    {
+        size_split(t, block, &block->size_left, &block->size_right);
+        return block;
+    }
+    if (size_less(block, t))
+    {
+        t->size_left = size_insert(t->size_left, block);
+    }
+    else
+    {
+        t->size_right = size_insert(t->size_right, block);
+    }
+    return t;
+}
+
+static Node *size_remove(Node *t, Node *block)
+{
+    if (t == block)
+    {
+        return size_join(t->size_left, t->size_right);
+    }
+    if (size_less(block, t))
+    {
+        t->size_left = size_remove(t->size_left, block);
+    }
+    else
+    {
+        t->size_right = size_remove(t->size_right, block);
+    }
+    return t;
+}
+
+
+// Publish the largest free block after the address tree changed
+static void index_publish_largest(Arena *arena)
+{
+    __atomic_store_n(&arena->largest_free, arena->addr_root == NULL ? 0 : arena->addr_root->max_free,
+                     __ATOMIC_RELAXED);
+}
+
+// Add a free block to the free index
+static void index_insert(Arena *arena, Node *block)
+{
+    block->priority = next_priority(arena);
+    arena->addr_root = addr_insert(arena->addr_root, block);
+    arena->size_root = size_insert(arena->size_root, block);
+    stat_add(&arena->free_histogram[size_bucket(block->size)], 1);
+    index_publish_largest(arena);
+}
+
+// Remove a free block from the free index (before its start or size change)
+static void index_remove(Arena *arena, Node *block)
+{
+    arena->addr_root = addr_remove(arena->addr_root, block);
+    arena->size_root = size_remove(arena->size_root, block);
+    stat_add(&arena->free_histogram[size_bucket(block->size)], -1);
+    index_publish_largest(arena);
+}
+
+/*
+ * Every allocation starts on an alignment boundary (at least
+ * MM_DEFAULT_ALIGNMENT), so a free block fits a request when what is left
+ * after skipping to its first aligned byte is still large enough.  The
+ * skipped bytes stay behind as a free block of their own.
+ */
+static int align_slack(void *start, int alignment)
+{
+    return (int)((alignment - (uintptr_t)start % alignment) % alignment);
+}
+
+static bool block_fits(Node *block, int nbytes, int alignment)
+{
+    return block->size - align_slack(block->start, alignment) >= nbytes;
+}
+
+// Lowest addressed fitting block of an address subtree at or after from
+static Node *addr_first_fit(Node *t, char *from, int nbytes, int alignment, int *steps)
+{
+    if (t == NULL || t->max_free < nbytes)
+    {
+        return NULL;
+    }
+    (*steps)++;
+    if (from != NULL && (char *)t->start < from)
+    {
+        return addr_first_fit(t->addr_right, from, nbytes, alignment, steps);
+    }
+    Node *block = addr_first_fit(t->addr_left, from, nbytes, alignment, steps);
+    if (block != NULL)
+    {
+        return block;
+    }
+    if (block_fits(t, nbytes, alignment))
+    {
+        return t;
+    }
+    return addr_first_fit(t->addr_right, NULL, nbytes, alignment, steps);
+}
+
+// Smallest fitting block of a size subtree (lowest address on ties)
+static Node *size_best_fit(Node *t, int nbytes, int alignment, int *steps)
+{
+    if (t == NULL)
+    {
+        return NULL;
+    }
+    (*steps)++;
+    if (t->size < nbytes)
+    {
+        return size_best_fit(t->size_right, nbytes, alignment, steps);
+    }
+    Node *block = size_best_fit(t->size_left, nbytes, alignment, steps);
+    if (block != NULL)
+    {
+        return block;
+    }
+    if (block_fits(t, nbytes, alignment))
+    {
+        return t;
+    }
+    return size_best_fit(t->size_right, nbytes, alignment, steps);
+}
+
+// Largest fitting block of a size subtree (lowest address on ties)
+static Node *size_worst_fit(Node *t, int nbytes, int alignment, Node *block, int *steps)
+{
+    if (t == NULL)
+    {
+        return block;
+    }
+    (*steps)++;
+    if (t->size >= nbytes)
+    {
+        block = size_worst_fit(t->size_left, nbytes, alignment, block, steps);
+        if (block_fits(t, nbytes, alignment) && (block == NULL || t->size > block->size))
+        {
+            block = t;
+        }
+    }
+    return size_worst_fit(t->size_right, nbytes, alignment, block, steps);
+}
+
+static void count_steps(Arena *arena, int steps)
+{
+    stat_add_long(&arena->search_steps, steps);
+}
+
+// Lowest addressed free block that fits nbytes
+static Node *index_first_fit(Arena *arena, int nbytes, int alignment)
+{
+    // A subtree whose largest block has alignment - 1 bytes to spare always holds a
+    // fit, so the search only backtracks over blocks that miss by their slack
+    int steps = 0;
+    Node *block = addr_first_fit(arena->addr_root, NULL, nbytes, alignment, &steps);
+    count_steps(arena, steps);
+    return block;
+}
+
+// First free block that fits nbytes at or after the rover, wrapping around to the start
+static Node *index_next_fit(Arena *arena, int nbytes, int alignment)
+{
+    int steps = 0;
+    Node *block = NULL;
+    if (arena->rover != NULL)
+    {
+        block = addr_first_fit(arena->addr_root, arena->rover->start, nbytes, alignment, &steps);
+    }
+    if (block == NULL)
+    {
+        block = addr_first_fit(arena->addr_root, NULL, nbytes, alignment, &steps);
+    }
+    count_steps(arena, steps);
+    if (block != NULL)
+    {
+        arena->rover = block;
+    }
+    return block;
+}
+
+// Smallest free block that fits nbytes (lowest address on ties)
+static Node *index_best_fit(Arena *arena, int nbytes, int alignment)
+{
+    int steps = 0;
+    Node *block = size_best_fit(arena->size_root, nbytes, alignment, &steps);
+    count_steps(arena, steps);
+    return block;
+}
+
+// Largest free block that fits nbytes (lowest address on ties)
+static Node *index_worst_fit(Arena *arena, int nbytes, int alignment)
+{
+    if (arena->addr_root == NULL || arena->addr_root->max_free < nbytes)
+    {
+        return NULL;
+    }
+
+    // Every block of the largest size fits if it has room for any slack
+    int steps = 0;
+    Node *block;
+    int largest = arena->addr_root->max_free;
+    if (largest - (alignment - 1) >= nbytes)
+    {
+        block = addr_first_fit(arena->addr_root, NULL, largest, 1, &steps);
+    }
+    else
+    {
+        block = size_worst_fit(arena->size_root, nbytes, alignment, NULL, &steps);
+    }
+    count_steps(arena, steps);
+    return block;
+}
+
+// Add a slab of nodes to the free node list
+static bool grow_node_pool(Arena *arena, int count)
+{
+    // Zeroed so a fresh node is neither cached nor carries a stale serial
+    NodeSlab *slab = (NodeSlab *)calloc(1, sizeof(NodeSlab) + count * sizeof(Node));
+    if (slab == NULL)
+    {
+        return false;
+    }
+    slab->next = arena->node_slabs;
+    arena->node_slabs = slab;
+    for (int i = 0; i < count; i++)
+    {
+        slab->nodes[i].next = arena->free_nodes;
+        arena->free_nodes = &slab->nodes[i];
+    }
+    return true;
+}
+
+// Take a node from the pool (NULL if the pool is empty and cannot grow)
+static Node *node_alloc(Arena *arena)
+{
+    if (arena->free_nodes == NULL)
+    {
+        if (!grow_node_pool(arena, arena->slab_nodes))
+        {
+            return NULL;
+        }
+        if (arena->slab_nodes < MAX_SLAB_NODES)
+        {
+            arena->slab_nodes *= 2;
+        }
+    }
+    Node *node = arena->free_nodes;
+    arena->free_nodes = node->next;
+    return node;
+}
+
+// Return a node that is no longer part of memory_list to the pool (it was merged into node->prev)
+static void node_release(Arena *arena, Node *node)
+{
+    if (arena->rover == node)
+    {
+        arena->rover = node->prev;
+    }
+    node->next = arena->free_nodes;
+    arena->free_nodes = node;
+}
+
+static unsigned int hash_index(Arena *arena, void *ptr)
+{
+    // Fibonacci hashing of the offset into the arena
+    uint64_t offset = (uint64_t)((char *)ptr - arena->start);
+    return (unsigned int)((offset * 0x9E3779B97F4A7C15ull) >> (64 - arena->hash_bits));
+}
+
+static void hash_insert(Arena *arena, Node *block)
+{
+    unsigned int index = hash_index(arena, block->start);
+    block->hash_next = arena->hash_table[index];
+    arena->hash_table[index] = block;
+}
+
+// Allocated block starting at ptr (NULL if there is none)
+static Node *hash_find(Arena *arena, void *ptr)
+{
+    Node *block = arena->hash_table[hash_index(arena, ptr)];
+    while (block != NULL && block->start != ptr)
+    {
+        block = block->hash_next;
+    }
+    return block;
+}
+
+static void hash_remove(Arena *arena, Node *block)
+{
+    Node **link = &arena->hash_table[hash_index(arena, block->start)];
+    while (*link != block)
+    {
+        link = &(*link)->hash_next;
+    }
+    *link = block->hash_next;
+    block->hash_next = NULL;
+}
+
+// Arena of the heap owning the given address (NULL if the address is not managed)
+static Arena *arena_of(mm_heap_t *heap, void *ptr)
+{
+    if (heap->arenas == NULL || (char *)ptr < heap->arenas[0].start)
+    {
+        return NULL;
+    }
+    int index = (int)(((char *)ptr - heap->arenas[0].start) / heap->arena_span);
+    if (index >= heap->arena_count)
+    {
+        index = heap->arena_count - 1;
+    }
+    Arena *arena = &heap->arenas[index];
+    return (char *)ptr < arena->start + arena->size ? arena : NULL;
+}
+
+// Arena of the heap a thread allocates from first
+static int pick_home_arena(mm_heap_t *heap)
+{
+    if (heap->assignment == MM_ARENA_BY_CPU)
+    {
+        int cpu = sched_getcpu();
+        return cpu < 0 ? 0 : cpu % heap->arena_count;
+    }
+    if (home_ticket < 0)
+    {
+        home_ticket = __atomic_fetch_add(&next_home_ticket, 1, __ATOMIC_RELAXED) & INT_MAX;
+    }
+    return home_ticket % heap->arena_count;
+}
+
+static void arena_destroy(Arena *arena);
+
+// Set up an arena as one free block covering [start, start + size), commit_chunk is 0 unless it is mapped,
+// returns false (with nothing left allocated) if the bookkeeping could not be allocated
+static bool arena_init(Arena *arena, char *start, int size, int commit_chunk)
+{
+    pthread_mutex_init(&arena->lock, NULL);
+    arena->start = start;
+    arena->size = size;
+    arena->priority_seed = 2463534242u;
+    arena->rover = NULL;
+    memset(arena->quick_lists, 0, sizeof(arena->quick_lists));
+    arena->quick_limit = 0;
+    arena->compact_from = start;
+    arena->commit_chunk = commit_chunk;
+    arena->committed = commit_chunk > 0 ? 0 : size;
+
+    // Preallocate bookkeeping nodes in proportion to the managed space (a mapped arena grows into it)
+    arena->node_slabs = NULL;
+    arena->free_nodes = NULL;
+    arena->slab_nodes = (commit_chunk > 0 ? commit_chunk : size) / 256;
+    if (arena->slab_nodes < MIN_SLAB_NODES)
+    {
+        arena->slab_nodes = MIN_SLAB_NODES;
+    }
+    if (arena->slab_nodes > MAX_SLAB_NODES)
+    {
+        arena->slab_nodes = MAX_SLAB_NODES;
+    }
+    grow_node_pool(arena, arena->slab_nodes);
+
+    // Initialize memory list with the entire arena as one free block
+    arena->hash_table = NULL;
+    arena->memory_list = node_alloc(arena);
+    if (arena->memory_list == NULL)
+    {
+        arena_destroy(arena);
+        return false;
+    }
+    arena->memory_list->start = start;
+    arena->memory_list->size = size;
+    arena->memory_list->allocated = 0;
+    arena->memory_list->next = NULL;
+    arena->memory_list->prev = NULL;
+
+    // Size the allocated block table to the managed space
+    arena->hash_bits = MIN_HASH_BITS;
+    while (arena->hash_bits < MAX_HASH_BITS && (1 << arena->hash_bits) < size / 64)
+    {
+        arena->hash_bits++;
+    }
+    arena->hash_table = (Node **)calloc(1 << arena->hash_bits, sizeof(Node *));
+    if (arena->hash_table == NULL)
+    {
+        arena_destroy(arena);
+        return false;
+    }
+
+    arena->allocated_bytes = 0;
+    arena->free_bytes = size;
+    arena->fragment_count = 1;
+    arena->largest_free = 0;
+    arena->quick_count = 0;
+    memset(arena->free_histogram, 0, sizeof(arena->free_histogram));
+    arena->search_steps = 0;
+    arena->splits = 0;
+    arena->merges = 0;
+    arena->relocations = 0;
+    arena->trimmed_bytes = 0;
+
+    arena->addr_root = NULL;
+    arena->size_root = NULL;
+    index_insert(arena, arena->memory_list);
+    return true;
+}
+
+static void arena_destroy(Arena *arena)
+{
+    // Free all node slabs (this releases every node in the memory list)
+    while (arena->node_slabs != NULL)
+    {
+        NodeSlab *temp = arena->node_slabs;
+        arena->node_slabs = arena->node_slabs->next;
+        free(temp);
+    }
+    free(arena->hash_table);
+    pthread_mutex_destroy(&arena->lock);
+}
+
+// Make sure everything below end is committed, returns false if the system refuses
+static bool arena_commit(Arena *arena, char *end)
+{
+    int needed = (int)(end - arena->start);
+    if (needed <= arena->committed)
+    {
+        return true;
+    }
+    // Whole chunks, but never past the end of the arena
+    int limit = arena->committed + (needed - arena->committed + arena->commit_chunk - 1) / arena->commit_chunk *
+                                       arena->commit_chunk;
+    if (limit > arena->size || limit < needed)
+    {
+        limit = arena->size;
+    }
+    if (mprotect(arena->start + arena->committed, limit - arena->committed, PROT_READ | PROT_WRITE) != 0)
+    {
+        return false;
+    }
+    stat_add(&arena->committed, limit - arena->committed);
+    return true;
+}
+
+// Give the pages of a free block at the end of the arena back, keeping keep bytes committed past its start
+static void trim_tail(Arena *arena, Node *tail, int keep)
+{
+    if (arena->commit_chunk == 0 || tail->allocated || tail->next != NULL)
+    {
+        return;
+    }
+    int offset = (int)((char *)tail->start - arena->start);
+    long long from = (offset + (long long)arena->commit_chunk - 1) / arena->commit_chunk * arena->commit_chunk + keep;
+    if (from >= arena->committed)
+    {
+        return;
+    }
+    int length = arena->committed - (int)from;
+    madvise(arena->start + from, length, MADV_DONTNEED);
+    mprotect(arena->start + from, length, PROT_NONE);
+    stat_add(&arena->committed, -length);
+    stat_add_long(&arena->trimmed_bytes, length);
+}
+
+// Split block so that a new node covers everything from offset on (NULL if no node is left)
+static Node *split_block(Arena *arena, Node *block, int offset)
+{
+    Node *new_block = node_alloc(arena);
+    if (new_block == NULL)
+    {
+        return NULL;
+    }
+    new_block->start = (char *)block->start + offset;
+    new_block->size = block->size - offset;
+    new_block->allocated = 0;
+    new_block->handle = NULL;
+    new_block->next = block->next;
+    new_block->prev = block;
+    if (block->next != NULL)
+    {
+        block->next->prev = new_block;
+    }
+    block->next = new_block;
+    block->size = offset;
+    stat_add_long(&arena->splits, 1);
+    return new_block;
+}
+
+static void free_block(Arena *arena, Node *curr);
+
+static void *allocate_memory(Arena *arena, Node *block, int nbytes, int alignment)
+{
+    index_remove(arena, block);
+    stat_add(&arena->fragment_count, -1);
+
+    // Leave the bytes before the aligned start behind as a free block
+    int slack = align_slack(block->start, alignment);
+    if (slack > 0)
+    {
+        Node *aligned = split_block(arena, block, slack);
+        index_insert(arena, block);
+        stat_add(&arena->fragment_count, 1);
+        if (aligned == NULL)
+        {
+            return NULL; // No node left to split off the slack
+        }
+        block = aligned;
+    }
+
+    // Split the block into two (without a spare node the whole block is handed out)
+    Node *new_block = block->size > nbytes ? split_block(arena, block, nbytes) : NULL;
+    if (new_block != NULL)
+    {
+        index_insert(arena, new_block);
+        stat_add(&arena->fragment_count, 1);
+    }
+
+    // Allocate from the block
+    block->allocated = 1;
+    hash_insert(arena, block);
+    stat_add(&arena->free_bytes, -block->size);
+    stat_add(&arena->allocated_bytes, block->size);
+    if (!arena_commit(arena, (char *)block->start + block->size))
+    {
+        free_block(arena, block);
+        return NULL; // Out of memory backing the mapping
+    }
+
+    // Return the start address of the allocated block
+    return block->start;
+}
+
+// Return an allocated block to the free index, merging it with free neighbours
+static void free_block(Arena *arena, Node *curr)
+{
+    hash_remove(arena, curr);
+    __atomic_store_n(&curr->serial, curr->serial + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&curr->cached, 0, __ATOMIC_RELEASE);
+    curr->allocated = 0;
+    stat_add(&arena->allocated_bytes, -curr->size);
+    stat_add(&arena->free_bytes, curr->size);
+    stat_add(&arena->fragment_count, 1);
+
+    // Merge with the previous free block if applicable
+    Node *prev = curr->prev;
+    if (prev != NULL && !(prev->allocated))
+    {
+        index_remove(arena, prev);
+        stat_add(&arena->fragment_count, -1);
+        stat_add_long(&arena->merges, 1);
+        prev->size += curr->size;
+        prev->next = curr->next;
+        if (curr->next != NULL)
+        {
+            curr->next->prev = prev;
+        }
+        node_release(arena, curr);
+        curr = prev; // Move back to the merged block
+    }
+
+    // Merge with the next free block if applicable
+    if (curr->next != NULL && !(curr->next->allocated))
+    {
+        Node *absorbed = curr->next;
+        index_remove(arena, absorbed);
+        stat_add(&arena->fragment_count, -1);
+        stat_add_long(&arena->merges, 1);
+        curr->size += absorbed->size;
+        curr->next = absorbed->next;
+        node_release(arena, absorbed);
+        if (curr->next != NULL)
+        {
+            curr->next->prev = curr;
+        }
+    }
+    index_insert(arena, curr);
+    trim_tail(arena, curr, TRIM_KEEP_CHUNKS * arena->commit_chunk);
+}
+
+// Resize an allocated block without moving it, returns false if the next block cannot supply the space
+static bool resize_in_place(Arena *arena, Node *curr, int nbytes)
+{
+    Node *next = curr->next;
+    bool next_free = next != NULL && !next->allocated;
+    if (nbytes > curr->size)
+    {
+        // Grow into the next block
+        int needed = nbytes - curr->size;
+        if (!next_free || next->size < needed || !arena_commit(arena, (char *)curr->start + nbytes))
+        {
+            return false;
+        }
+        index_remove(arena, next);
+        if (next->size == needed)
+        {
+            curr->next = next->next;
+            if (next->next != NULL)
+            {
+                next->next->prev = curr;
+            }
+            node_release(arena, next);
+            stat_add(&arena->fragment_count, -1);
+            stat_add_long(&arena->merges, 1);
+        }
+        else
+        {
+            next->start = (char *)next->start + needed;
+            next->size -= needed;
+            index_insert(arena, next);
+        }
+        curr->size = nbytes;
+        stat_add(&arena->free_bytes, -needed);
+        stat_add(&arena->allocated_bytes, needed);
+        return true;
+    }
+
+    // Shrink by handing the tail to the next free block or splitting it off
+    int tail = curr->size - nbytes;
+    if (tail == 0)
+    {
+        return true;
+    }
+    if (next_free)
+    {
+        index_remove(arena, next);
+        next->start = (char *)next->start - tail;
+        next->size += tail;
+        index_insert(arena, next);
+        trim_tail(arena, next, TRIM_KEEP_CHUNKS * arena->commit_chunk);
+    }
+    else
+    {
+        next = split_block(arena, curr, nbytes);
+        if (next == NULL)
+        {
+            return true; // No spare node, the block keeps its tail
+        }
+        index_insert(arena, next);
+        stat_add(&arena->fragment_count, 1);
+    }
+    curr->size = nbytes;
+    stat_add(&arena->allocated_bytes, -tail);
+    stat_add(&arena->free_bytes, tail);
+    return true;
+}
+
+static int quick_index(int size)
+{
+    return (size - 1) / QUICK_GRANULE;
+}
+
+// Put a freed block on its quick list without merging it (it keeps its hash table entry)
+static void quick_push(Arena *arena, Node *block)
+{
+    __atomic_store_n(&block->serial, block->serial + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&block->cached, 0, __ATOMIC_RELEASE);
+    block->quick = 1;
+    Node **list = &arena->quick_lists[quick_index(block->size)];
+    block->quick_next = *list;
+    *list = block;
+    stat_add(&arena->quick_count, 1);
+    stat_add(&arena->allocated_bytes, -block->size);
+    stat_add(&arena->free_bytes, block->size);
+    stat_add(&arena->fragment_count, 1);
+    stat_add(&arena->free_histogram[size_bucket(block->size)], 1);
+}
+
+// Take the first block off a quick list, it is allocated again
+static Node *quick_pop(Arena *arena, Node **list)
+{
+    Node *block = *list;
+    *list = block->quick_next;
+    block->quick = 0;
+    stat_add(&arena->quick_count, -1);
+    stat_add(&arena->allocated_bytes, block->size);
+    stat_add(&arena->free_bytes, -block->size);
+    stat_add(&arena->fragment_count, -1);
+    stat_add(&arena->free_histogram[size_bucket(block->size)], -1);
+    return block;
+}
+
+// Merge every block waiting on the quick lists into the free index
+static void consolidate(Arena *arena)
+{
+    for (int i = 0; i < QUICK_LISTS; i++)
+    {
+        while (arena->quick_lists[i] != NULL)
+        {
+            free_block(arena, quick_pop(arena, &arena->quick_lists[i]));
+        }
+    }
+}
+
+// Return an allocated block to the arena, deferring the merge while lazy coalescing is on
+static void release_block(Arena *arena, Node *block)
+{
+    if (arena->quick_limit == 0 || block->size <= 0 || block->size > QUICK_MAX)
+    {
+        free_block(arena, block);
+        return;
+    }
+    quick_push(arena, block);
+    if (arena->quick_count > arena->quick_limit)
+    {
+        consolidate(arena);
+    }
+}
+
+// Allocate from the quick list of the size if its latest block is large enough (NULL on a miss)
+static void *quick_alloc(Arena *arena, int nbytes)
+{
+    if (nbytes <= 0 || nbytes > QUICK_MAX)
+    {
+        return NULL;
+    }
+    Node **list = &arena->quick_lists[quick_index(nbytes)];
+    if (*list == NULL || (*list)->size < nbytes)
+    {
+        return NULL;
+    }
+    return quick_pop(arena, list)->start;
+}
+
+// Run the placement algorithm, consolidating the quick lists and searching again if it fails
+static Node *find_block(Arena *arena, fit_function fit, int nbytes, int alignment)
+{
+    Node *block = fit(arena, nbytes, alignment);
+    if (block == NULL && arena->quick_count > 0)
+    {
+        consolidate(arena);
+        block = fit(arena, nbytes, alignment);
+    }
+    return block;
+}
+
+// Compaction may only move relocatable blocks that nobody holds a raw pointer to
+static bool movable(Node *block)
+{
+    return block->handle != NULL && block->handle->pins == 0 && !block->quick &&
+           !__atomic_load_n(&block->cached, __ATOMIC_ACQUIRE);
+}
+
+// Move block down into the free block (hole) right in front of it, the free space ends up behind it
+static bool slide_block(Arena *arena, Node *hole, Node *block)
+{
+    // Bytes before the aligned start stay behind as a free block of their own
+    int slack = align_slack(hole->start, MM_DEFAULT_ALIGNMENT);
+    Node *after = slack > 0 ? node_alloc(arena) : hole;
+    if (after == NULL)
+    {
+        return false; // No node for the free space behind the block
+    }
+    index_remove(arena, hole);
+    char *target = (char *)hole->start + slack;
+    int free_size = hole->size - slack;
+    memmove(target, block->start, block->size);
+
+    hash_remove(arena, block);
+    block->start = target;
+    block->handle->ptr = target;
+    hash_insert(arena, block);
+    __atomic_store_n(&block->serial, block->serial + 1, __ATOMIC_RELEASE); // Forget thread cache owners
+    stat_add_long(&arena->relocations, 1);
+
+    if (slack > 0)
+    {
+        hole->size = slack;
+        index_insert(arena, hole);
+        stat_add(&arena->fragment_count, 1);
+        after->allocated = 0;
+        after->cached = 0;
+        after->quick = 0;
+        after->handle = NULL;
+    }
+    else
+    {
+        // Unlink the hole from in front of the block
+        if (hole->prev != NULL)
+        {
+            hole->prev->next = block;
+        }
+        else
+        {
+            arena->memory_list = block;
+        }
+        block->prev = hole->prev;
+    }
+
+    // Link the free space in behind the block, merging it with a free successor
+    after->start = target + block->size;
+    after->size = free_size;
+    after->next = block->next;
+    after->prev = block;
+    if (block->next != NULL)
+    {
+        block->next->prev = after;
+    }
+    block->next = after;
+    Node *next = after->next;
+    if (next != NULL && !next->allocated)
+    {
+        index_remove(arena, next);
+        stat_add(&arena->fragment_count, -1);
+        stat_add_long(&arena->merges, 1);
+        after->size += next->size;
+        after->next = next->next;
+        if (next->next != NULL)
+        {
+            next->next->prev = after;
+        }
+        node_release(arena, next);
+    }
+    index_insert(arena, after);
+    return true;
+}
+
+// One bounded piece of compaction work, returns true once the arena has been swept to its end
+static bool compact_step(Arena *arena)
+{
+    consolidate(arena);
+    int steps = 0;
+    Node *hole = addr_first_fit(arena->addr_root, arena->compact_from, 0, 1, &steps);
+    if (hole == NULL || hole->next == NULL)
+    {
+        arena->compact_from = arena->start;
+        return true; // Only the free tail (if any) is left
+    }
+
+    // Free neighbours are always merged, so the hole is followed by an allocated block
+    // A hole that is nothing but alignment slack has no room to slide the block into
+    Node *block = hole->next;
+    if (hole->size - align_slack(hole->start, MM_DEFAULT_ALIGNMENT) == 0 || !movable(block) ||
+        !slide_block(arena, hole, block))
+    {
+        arena->compact_from = (char *)block->start + block->size; // Leave the hole, it cannot be filled
+        return false;
+    }
+    arena->compact_from = (char *)block->start + block->size;
+    return false;
+}
+
+// Report an invalid free and terminate
+static void invalid_free()
+{
+    printf("Segmentation fault\n\n");
+    exit(EXIT_FAILURE);
+}
+
+static unsigned int owned_index(mm_heap_t *heap, void *ptr)
+{
+    uint64_t offset = (uint64_t)((char *)ptr - heap->arenas[0].start);
+    return (unsigned int)((offset * 0x9E3779B97F4A7C15ull) >> (64 - TCACHE_OWNED_BITS));
+}
+
+// Bin used for blocks of the given size, the bins group sizes by 16 byte
+// size class (size / MM_DEFAULT_ALIGNMENT) rather than by the raw size
+static TCacheBin *tcache_bin(TCache *cache, int size)
+{
+    return &cache->bins[((unsigned int)size / MM_DEFAULT_ALIGNMENT) % TCACHE_BINS];
+}
+
+// Remember that this thread handed out the block (the arena lock must be held)
+static void tcache_own(TCache *cache, Node *block)
+{
+    TCacheEntry *entry = &cache->owned[owned_index(cache->heap, block->start)];
+    entry->start = block->start;
+    entry->block = block;
+    entry->serial = block->serial;
+}
+
+// Return the oldest count blocks of a bin to their arenas
+static void tcache_flush(TCache *cache, TCacheBin *bin, int count)
+{
+    if (count > bin->count)
+    {
+        count = bin->count;
+    }
+    Arena *locked = NULL;
+    for (int i = 0; i < count; i++)
+    {
+        Node *block = bin->blocks[i];
+        Arena *arena = arena_of(cache->heap, block->start);
+        if (arena != locked)
+        {
+            if (locked != NULL)
+            {
+                pthread_mutex_unlock(&locked->lock);
+            }
+            pthread_mutex_lock(&arena->lock);
+            locked = arena;
+        }
+        cache->cached_bytes -= block->size;
+        release_block(arena, block);
+    }
+    if (locked != NULL)
+    {
+        pthread_mutex_unlock(&locked->lock);
+    }
+    bin->count -= count;
+    for (int i = 0; i < bin->count; i++)
+    {
+        bin->blocks[i] = bin->blocks[i + count];
+    }
+}
+
+static void tcache_flush_all(TCache *cache)
+{
+    for (int i = 0; i < TCACHE_BINS; i++)
+    {
+        tcache_flush(cache, &cache->bins[i], cache->bins[i].count);
+    }
+}
+
+// Thread exit hook, returns whatever the exiting thread still caches and drops the cache
+static void tcache_thread_exit(void *arg)
+{
+    TCache *cache = (TCache *)arg;
+    mm_heap_t *heap = cache->heap;
+    tcache_flush_all(cache);
+
+    pthread_mutex_lock(&heap->lock);
+    if (cache->prev != NULL)
+    {
+        cache->prev->next = cache->next;
+    }
+    else
+    {
+        heap->caches = cache->next;
+    }
+    if (cache->next != NULL)
+    {
+        cache->next->prev = cache->prev;
+    }
+    pthread_mutex_unlock(&heap->lock);
+    free(cache);
+}
+
+// Cache of the calling thread for the heap, created on first use (NULL if there is none)
+static TCache *tcache_get(mm_heap_t *heap, bool create)
+{
+    if (!heap->has_cache_key)
+    {
+        return NULL;
+    }
+    TCache *cache = (TCache *)pthread_getspecific(heap->cache_key);
+    if (cache != NULL || !create)
+    {
+        return cache;
+    }
+
+    cache = (TCache *)calloc(1, sizeof(TCache));
+    if (cache == NULL)
+    {
+        return NULL;
+    }
+    cache->heap = heap;
+    pthread_mutex_lock(&heap->lock);
+    cache->next = heap->caches;
+    if (cache->next != NULL)
+    {
+        cache->next->prev = cache;
+    }
+    heap->caches = cache;
+    pthread_mutex_unlock(&heap->lock);
+    pthread_setspecific(heap->cache_key, cache);
+    return cache;
+}
+
+// Allocate from one arena, refilling the thread cache (if any) while the lock is held
+static void *arena_alloc(Arena *arena, fit_function fit, int nbytes, int alignment, TCache *cache)
+{
+    pthread_mutex_lock(&arena->lock);
+    void *ptr = NULL;
+    if (arena->quick_count > 0 && alignment == MM_DEFAULT_ALIGNMENT)
+    {
+        ptr = quick_alloc(arena, nbytes);
+    }
+    if (ptr == NULL)
+    {
+        Node *block = find_block(arena, fit, nbytes, alignment);
+        ptr = block == NULL ? NULL : allocate_memory(arena, block, nbytes, alignment);
+    }
+    if (ptr == NULL)
+    {
+        pthread_mutex_unlock(&arena->lock);
+        return NULL; // No suitable free block found
+    }
+    Node *block = hash_find(arena, ptr);
+
+    if (cache != NULL)
+    {
+        // Take a batch of blocks of the same size for the thread cache
+        TCacheBin *bin = tcache_bin(cache, nbytes);
+        int limit = stat_read(&cache->heap->tcache_limit);
+        tcache_own(cache, block);
+        if (bin->count == 0)
+        {
+            bin->size = nbytes;
+        }
+        for (int i = 1; i < TCACHE_BATCH && bin->size == nbytes && bin->count < TCACHE_BIN_BLOCKS &&
+                        cache->cached_bytes + nbytes <= limit;
+             i++)
+        {
+            Node *extra = fit(arena, nbytes, alignment);
+            void *extra_ptr = extra == NULL ? NULL : allocate_memory(arena, extra, nbytes, alignment);
+            if (extra_ptr == NULL)
+            {
+                break;
+            }
+            extra = hash_find(arena, extra_ptr);
+            tcache_own(cache, extra);
+            __atomic_store_n(&extra->cached, 1, __ATOMIC_RELEASE);
+            bin->blocks[bin->count++] = extra;
+            cache->cached_bytes += extra->size;
+        }
+    }
+    pthread_mutex_unlock(&arena->lock);
+
+    return block->start;
+}
+
+// Take a block from the thread cache (NULL on a miss)
+static void *tcache_alloc(TCache *cache, int nbytes)
+{
+    TCacheBin *bin = tcache_bin(cache, nbytes);
+    if (bin->size != nbytes || bin->count == 0)
+    {
+        return NULL;
+    }
+    Node *block = bin->blocks[--bin->count];
+    cache->cached_bytes -= block->size;
+    __atomic_store_n(&block->cached, 0, __ATOMIC_RELEASE);
+    return block->start;
+}
+
+// Free into the thread cache, returns false if the block must take the locked path
+static bool tcache_free(TCache *cache, void *ptr)
+{
+    int limit = stat_read(&cache->heap->tcache_limit);
+    if (cache->cached_bytes > limit)
+    {
+        tcache_flush_all(cache); // The limit was lowered
+    }
+
+    TCacheEntry *entry = &cache->owned[owned_index(cache->heap, ptr)];
+    Node *block = entry->block;
+    if (block == NULL || entry->start != ptr || __atomic_load_n(&block->serial, __ATOMIC_ACQUIRE) != entry->serial)
+    {
+        return false; // Not handed out by this thread (or freed elsewhere since)
+    }
+    if (__atomic_load_n(&block->cached, __ATOMIC_ACQUIRE))
+    {
+        invalid_free(); // Double free of a cached block
+    }
+
+    TCacheBin *bin = tcache_bin(cache, block->size);
+    if (block->size > limit || (bin->count > 0 && bin->size != block->size))
+    {
+        entry->block = NULL;
+        return false; // Too big to cache or the bin holds another size
+    }
+    bin->size = block->size;
+    if (bin->count == TCACHE_BIN_BLOCKS || cache->cached_bytes + block->size > limit)
+    {
+        tcache_flush(cache, bin, TCACHE_BATCH);
+        if (cache->cached_bytes + block->size > limit)
+        {
+            tcache_flush_all(cache);
+        }
+    }
+
+    __atomic_store_n(&block->cached, 1, __ATOMIC_RELEASE);
+    bin->blocks[bin->count++] = block;
+    cache->cached_bytes += block->size;
+    return true;
+}
+
+// Allocate nbytes from the block of the heap chosen by the placement algorithm
+static void *place(mm_heap_t *heap, fit_function fit, int nbytes, int alignment)
+{
+    if (heap->arenas == NULL)
+    {
+        return NULL; // Not initialized
+    }
+
+    // Cached blocks only carry the default alignment
+    void *ptr = NULL;
+    TCache *cache = NULL;
+    if (stat_read(&heap->tcache_limit) > 0 && alignment == MM_DEFAULT_ALIGNMENT)
+    {
+        cache = tcache_get(heap, true);
+        ptr = cache == NULL ? NULL : tcache_alloc(cache, nbytes);
+    }
+
+    // Try the home arena first and fall back to the others in order
+    int home = pick_home_arena(heap);
+    for (int i = 0; ptr == NULL && i < heap->arena_count; i++)
+    {
+        ptr = arena_alloc(&heap->arenas[(home + i) % heap->arena_count], fit, nbytes, alignment, cache);
+    }
+
+    if (ptr != NULL)
+    {
+        __atomic_fetch_add(&heap->malloc_count, 1, __ATOMIC_RELAXED);
+    }
+    return ptr;
+}
+
+static long long trace_clock()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Give the ring of an exiting thread up for adoption
+static void trace_thread_exit(void *ring)
+{
+    __atomic_store_n(&((TraceRing *)ring)->owned, 0, __ATOMIC_RELEASE);
+}
+
+static void trace_make_key()
+{
+    pthread_key_create(&trace_key, trace_thread_exit);
+}
+
+// Ring of the calling thread, adopting one given up by an exited thread when possible
+static TraceRing *trace_own_ring()
+{
+    if (trace_ring != NULL)
+    {
+        return trace_ring;
+    }
+
+    TraceRing *ring = __atomic_load_n(&trace_rings, __ATOMIC_ACQUIRE);
+    int unowned = 0;
+    while (ring != NULL &&
+           !__atomic_compare_exchange_n(&ring->owned, &unowned, 1, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+    {
+        ring = ring->next;
+        unowned = 0;
+    }
+    if (ring == NULL)
+    {
+        ring = (TraceRing *)calloc(1, sizeof(TraceRing));
+        if (ring == NULL)
+        {
+            return NULL;
+        }
+        ring->owned = 1;
+        ring->next = __atomic_load_n(&trace_rings, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&trace_rings, &ring->next, ring, true, __ATOMIC_RELEASE,
+                                            __ATOMIC_RELAXED))
+        {
+        }
+    }
+    ring->thread = __atomic_fetch_add(&trace_threads, 1, __ATOMIC_RELAXED);
+    pthread_once(&trace_key_once, trace_make_key);
+    pthread_setspecific(trace_key, ring);
+    trace_ring = ring;
+    return ring;
+}
+
+static int32_t trace_offset(void *ptr)
+{
+    return ptr == NULL || default_heap.arenas == NULL ? -1 : (int32_t)((char *)ptr - default_heap.arenas[0].start);
+}
+
+// Count a public call and append it to the calling thread's ring if the default heap is being recorded
+static void record_call(mm_heap_t *heap, int op, int size, int alignment, void *result, void *old)
+{
+    __atomic_fetch_add(&heap->call_counts[op], 1, __ATOMIC_RELAXED);
+    if (heap != &default_heap || !__atomic_load_n(&trace_active, __ATOMIC_RELAXED))
+    {
+        return;
+    }
+    TraceRing *ring = trace_own_ring();
+    if (ring == NULL)
+    {
+        return;
+    }
+
+    // Announce the write before checking the flag again, mm_trace_stop waits for busy rings
+    __atomic_store_n(&ring->busy, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&trace_active, __ATOMIC_SEQ_CST))
+    {
+        unsigned int head = ring->head;
+        if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == TRACE_RING_RECORDS)
+        {
+            __atomic_fetch_add(&trace_dropped, 1, __ATOMIC_RELAXED);
+        }
+        else
+        {
+            struct mm_trace_record *record = &ring->records[head % TRACE_RING_RECORDS];
+            record->timestamp = (uint64_t)(trace_clock() - trace_epoch);
+            record->thread = ring->thread;
+            record->op = (uint16_t)op;
+            record->reserved = 0;
+            record->size = size;
+            record->alignment = alignment;
+            record->offset = trace_offset(result);
+            record->old_offset = trace_offset(old);
+            __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+        }
+    }
+    __atomic_store_n(&ring->busy, 0, __ATOMIC_RELEASE);
+}
+
+// Write every buffered record to the trace file
+static void trace_drain()
+{
+    for (TraceRing *ring = __atomic_load_n(&trace_rings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next)
+    {
+        unsigned int tail = ring->tail;
+        unsigned int head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        while (tail != head)
+        {
+            // Up to the end of the ring, then from its start
+            unsigned int index = tail % TRACE_RING_RECORDS;
+            unsigned int count = head - tail;
+            if (count > TRACE_RING_RECORDS - index)
+            {
+                count = TRACE_RING_RECORDS - index;
+            }
+            fwrite(&ring->records[index], sizeof(struct mm_trace_record), count, trace_file);
+            tail += count;
+        }
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+    fflush(trace_file);
+}
+
+static void *trace_flush_loop(void *args)
+{
+    (void)args;
+    struct timespec interval = {0, TRACE_FLUSH_MS * 1000000L};
+    while (__atomic_load_n(&trace_active, __ATOMIC_ACQUIRE))
+    {
+        trace_drain();
+        nanosleep(&interval, NULL);
+    }
+    return NULL;
+}
+
+static bool bit_test(unsigned char *bits, int index)
+{
+    return (bits[index / 8] >> (index % 8)) & 1;
+}
+
+static void bit_set(unsigned char *bits, int index, bool value)
+{
+    if (value)
+    {
+        bits[index / 8] |= (unsigned char)(1 << (index % 8));
+    }
+    else
+    {
+        bits[index / 8] &= (unsigned char)~(1 << (index % 8));
+    }
+}
+
+// Tree node of the buddy block of the given order starting at ptr
+static int buddy_node(BuddyZone *buddy, char *ptr, int order)
+{
+    int level = buddy->order - order;
+    return (1 << level) - 1 + (int)((ptr - buddy->start) >> order);
+}
+
+static void buddy_push(BuddyZone *buddy, char *ptr, int order)
+{
+    BuddyBlock *block = (BuddyBlock *)ptr;
+    block->prev = NULL;
+    block->next = buddy->free_lists[order];
+    if (block->next != NULL)
+    {
+        block->next->prev = block;
+    }
+    buddy->free_lists[order] = block;
+    stat_add(&buddy->free_bytes, 1 << order);
+    stat_add(&buddy->fragment_count, 1);
+    stat_add(&buddy->free_counts[order], 1);
+}
+
+static void buddy_unlink(BuddyZone *buddy, char *ptr, int order)
+{
+    BuddyBlock *block = (BuddyBlock *)ptr;
+    if (block->prev != NULL)
+    {
+        block->prev->next = block->next;
+    }
+    else
+    {
+        buddy->free_lists[order] = block->next;
+    }
+    if (block->next != NULL)
+    {
+        block->next->prev = block->prev;
+    }
+    stat_add(&buddy->free_bytes, -(1 << order));
+    stat_add(&buddy->fragment_count, -1);
+    stat_add(&buddy->free_counts[order], -1);
+}
+
+static void buddy_release(BuddyZone *buddy);
+
+// Carve a zone of 2^order bytes out of the arenas of the heap (the buddy lock must be held),
+// returns false with the zone left disabled if there is no room or the bitmaps cannot be allocated
+static bool buddy_reserve(mm_heap_t *heap, int order)
+{
+    BuddyZone *buddy = &heap->buddy;
+    // The bitmaps come first, so a failure never leaves a zone carved out with nothing to track it
+    int nodes = (2 << (order - BUDDY_MIN_ORDER)) - 1;
+    buddy->split = (unsigned char *)calloc(nodes / 8 + 1, 1);
+    buddy->allocated = (unsigned char *)calloc(nodes / 8 + 1, 1);
+    if (buddy->split == NULL || buddy->allocated == NULL)
+    {
+        buddy_release(buddy);
+        return false;
+    }
+
+    // The free list links live in the free blocks so the zone is aligned for them
+    char *zone = NULL;
+    for (int i = 0; zone == NULL && i < heap->arena_count; i++)
+    {
+        pthread_mutex_lock(&heap->arenas[i].lock);
+        Node *block = find_block(&heap->arenas[i], index_first_fit, 1 << order, BUDDY_ALIGNMENT);
+        if (block != NULL)
+        {
+            zone = allocate_memory(&heap->arenas[i], block, 1 << order, BUDDY_ALIGNMENT);
+        }
+        pthread_mutex_unlock(&heap->arenas[i].lock);
+    }
+    if (zone == NULL)
+    {
+        buddy_release(buddy);
+        return false;
+    }
+
+    buddy->order = order;
+    memset(buddy->free_lists, 0, sizeof(buddy->free_lists));
+    buddy->allocated_bytes = 0;
+    buddy->free_bytes = 0;
+    buddy->fragment_count = 0;
+    memset(buddy->free_counts, 0, sizeof(buddy->free_counts));
+    buddy->splits = 0;
+    buddy->merges = 0;
+    buddy_push(buddy, zone, order);
+    __atomic_store_n(&buddy->zone_bytes, 1 << order, __ATOMIC_RELAXED);
+    __atomic_store_n(&buddy->start, zone, __ATOMIC_RELEASE);
+    return true;
+}
+
+static void buddy_release(BuddyZone *buddy)
+{
+    free(buddy->split);
+    free(buddy->allocated);
+    buddy->split = NULL;
+    buddy->allocated = NULL;
+    __atomic_store_n(&buddy->start, NULL, __ATOMIC_RELEASE);
+    buddy->zone_bytes = 0;
+    buddy->allocated_bytes = 0;
+    buddy->free_bytes = 0;
+    buddy->fragment_count = 0;
+    memset(buddy->free_counts, 0, sizeof(buddy->free_counts));
+    buddy->splits = 0;
+    buddy->merges = 0;
+}
+
+// Largest zone order that still fits in the biggest free block of any arena of the heap
+static int buddy_default_order(mm_heap_t *heap)
+{
+    int largest = 0;
+    for (int i = 0; i < heap->arena_count; i++)
+    {
+        pthread_mutex_lock(&heap->arenas[i].lock);
+        consolidate(&heap->arenas[i]);
+        if (heap->arenas[i].addr_root != NULL && heap->arenas[i].addr_root->max_free > largest)
+        {
+            largest = heap->arenas[i].addr_root->max_free;
+        }
+        pthread_mutex_unlock(&heap->arenas[i].lock);
+    }
+    int order = BUDDY_MIN_ORDER;
+    while (order < BUDDY_MAX_ORDER && (2 << order) + BUDDY_ALIGNMENT - 1 <= largest)
+    {
+        order++;
+    }
+    return (1 << order) + BUDDY_ALIGNMENT - 1 <= largest ? order : -1;
+}
+
+static bool in_buddy_zone(BuddyZone *buddy, void *ptr)
+{
+    char *start = __atomic_load_n(&buddy->start, __ATOMIC_ACQUIRE);
+    return start != NULL && (char *)ptr >= start && (char *)ptr < start + (1 << buddy->order);
+}
+
+// Order of the allocated buddy block starting at ptr, -1 if there is none (the buddy lock must be held)
+static int buddy_lookup(BuddyZone *buddy, void *ptr, int *node)
+{
+    // Walk down the split nodes to the block containing ptr
+    int order = buddy->order;
+    *node = 0;
+    while (order > BUDDY_MIN_ORDER && bit_test(buddy->split, *node))
+    {
+        order--;
+        *node = buddy_node(buddy, (char *)ptr, order);
+    }
+    char *block = buddy->start + ((((char *)ptr - buddy->start) >> order) << order);
+    return block == (char *)ptr && bit_test(buddy->allocated, *node) ? order : -1;
+}
+
+// Return a buddy block and merge it with its free buddies
+static void buddy_free(BuddyZone *buddy, void *ptr)
+{
+    pthread_mutex_lock(&buddy->lock);
+    int node;
+    int order = buddy_lookup(buddy, ptr, &node);
+    if (order < 0)
+    {
+        pthread_mutex_unlock(&buddy->lock);
+        invalid_free(); // Not the start of an allocated buddy block
+    }
+    char *block = (char *)ptr;
+    bit_set(buddy->allocated, node, false);
+    stat_add(&buddy->allocated_bytes, -(1 << order));
+
+    // Merge upwards while the buddy is free as well
+    while (order < buddy->order)
+    {
+        int buddy_index = node % 2 == 1 ? node + 1 : node - 1;
+        if (bit_test(buddy->split, buddy_index) || bit_test(buddy->allocated, buddy_index))
+        {
+            break;
+        }
+        char *buddy_block = buddy->start + ((block - buddy->start) ^ (1 << order));
+        buddy_unlink(buddy, buddy_block, order);
+        block = block < buddy_block ? block : buddy_block;
+        node = (node - 1) / 2;
+        bit_set(buddy->split, node, false);
+        stat_add_long(&buddy->merges, 1);
+        order++;
+    }
+    buddy_push(buddy, block, order);
+    pthread_mutex_unlock(&buddy->lock);
+}
+
+// Set up a heap managing [start, start + size) as count arenas (the locks must already be initialized),
+// returns false if the arenas could not be allocated, leaving the heap uninitialized (arenas NULL)
+static bool heap_init(mm_heap_t *heap, void *start, int size, int count, int assignment, int commit_chunk)
+{
+    heap->malloc_count = 0;
+    memset(heap->call_counts, 0, sizeof(heap->call_counts));
+    heap->pool_slab_bytes = 0;
+    heap->pool_allocated_bytes = 0;
+    if (count < 1)
+    {
+        count = 1;
+    }
+    if (count > size)
+    {
+        count = size > 0 ? size : 1;
+    }
+
+    heap->handle_slabs = NULL;
+    heap->free_handles = NULL;
+    heap->compact_arena = 0;
+    heap->map_base = NULL;
+    heap->map_bytes = 0;
+    heap->caches = NULL;
+    heap->has_cache_key = false;
+
+    // Equal sized arenas, the last one also takes any remainder
+    heap->arena_count = 0;
+    heap->arena_span = size / count;
+    heap->assignment = assignment;
+    heap->arenas = (Arena *)calloc(count, sizeof(Arena));
+    if (heap->arenas == NULL)
+    {
+        return false;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        int arena_size = i == count - 1 ? size - heap->arena_span * i : heap->arena_span;
+        if (!arena_init(&heap->arenas[i], (char *)start + heap->arena_span * i, arena_size, commit_chunk))
+        {
+            while (--i >= 0)
+            {
+                arena_destroy(&heap->arenas[i]);
+            }
+            free(heap->arenas);
+            heap->arenas = NULL;
+            return false;
+        }
+        heap->arenas[i].quick_limit = heap->quick_limit;
+    }
+    heap->arena_count = count;
+
+    // Without a key the heap simply runs without thread caches
+    heap->has_cache_key = pthread_key_create(&heap->cache_key, tcache_thread_exit) == 0;
+    return true;
+}
+
+// Release everything a heap allocated (the locks are left for the caller)
+static void heap_destroy(mm_heap_t *heap)
+{
+    pthread_mutex_lock(&heap->buddy.lock);
+    buddy_release(&heap->buddy);
+    pthread_mutex_unlock(&heap->buddy.lock);
+
+    // Thread caches only hold blocks of the arenas, so they go away with them
+    pthread_mutex_lock(&heap->lock);
+    if (heap->has_cache_key)
+    {
+        pthread_key_delete(heap->cache_key);
+        heap->has_cache_key = false;
+    }
+    while (heap->caches != NULL)
+    {
+        TCache *cache = heap->caches;
+        heap->caches = cache->next;
+        free(cache);
+    }
+    while (heap->handle_slabs != NULL)
+    {
+        HandleSlab *slab = heap->handle_slabs;
+        heap->handle_slabs = slab->next;
+        free(slab);
+    }
+    heap->free_handles = NULL;
+    pthread_mutex_unlock(&heap->lock);
+
+    for (int i = 0; i < heap->arena_count; i++)
+    {
+        arena_destroy(&heap->arenas[i]);
+    }
+    free(heap->arenas);
+    heap->arenas = NULL;
+    heap->arena_count = 0;
+    if (heap->map_base != NULL)
+    {
+        munmap(heap->map_base, heap->map_bytes);
+        heap->map_base = NULL;
+        heap->map_bytes = 0;
+    }
+    heap->pool_slab_bytes = 0;
+    heap->pool_allocated_bytes = 0;
+}
+
+// Set up a heap over a fresh reservation of at least reserve bytes, returns false if nothing could be mapped
+static bool heap_init_mapped(mm_heap_t *heap, int reserve, int flags)
+{
+    if (reserve <= 0)
+    {
+        return false;
+    }
+    bool huge = (flags & (MM_MAP_HUGETLB | MM_MAP_THP)) != 0;
+    size_t chunk = huge ? HUGE_PAGE_SIZE : MAP_CHUNK;
+    size_t size = ((size_t)reserve + chunk - 1) / chunk * chunk;
+    if (size > INT_MAX)
+    {
+        size -= chunk; // Sizes are ints
+    }
+
+    // Explicit huge pages are reserved from the system pool up front, so a pool too small fails here
+    // rather than with a SIGBUS later, and the heap falls back to normal pages
+    char *base = MAP_FAILED;
+    size_t map_bytes = size;
+    char *start = NULL;
+#ifdef MAP_HUGETLB
+    if (flags & MM_MAP_HUGETLB)
+    {
+        base = mmap(NULL, map_bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        start = base;
+    }
+#endif
+    if (base == MAP_FAILED)
+    {
+        // Transparent huge pages need the heap to start on a huge page boundary
+        map_bytes = huge ? size + HUGE_PAGE_SIZE : size;
+        base = mmap(NULL, map_bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (base == MAP_FAILED)
+        {
+            return false;
+        }
+        start = huge ? (char *)(((uintptr_t)base + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1)) : base;
+#ifdef MADV_HUGEPAGE
+        if (huge)
+        {
+            madvise(start, size, MADV_HUGEPAGE);
+        }
+#endif
+    }
+
+    if (!heap_init(heap, start, (int)size, 1, MM_ARENA_ROUND_ROBIN, (int)chunk))
+    {
+        munmap(base, map_bytes);
+        return false;
+    }
+    heap->map_base = base;
+    heap->map_bytes = map_bytes;
+    return true;
+}
+
+/**
+ * @brief Create a heap that manages the given location independently of the default heap
+ *        and of every other heap (its own arenas, locks, buddy zone, pools and statistics)
+ *        NOTE: Do NOT malloc space for the memory to manage
+ *              The invoker of this function will provide the memory
+ * @param start - the start of the memory to manage
+ * @param size - the size of the memory to manage
+ * @return the heap, or NULL if it cannot be created
+ */
+mm_heap_t *mm_create(void *start, int size)
+{
+    return mm_create_arenas(start, size, 1, MM_ARENA_ROUND_ROBIN);
+}
+
+/**
+ * @brief Create a heap that manages the given location as count independent arenas
+ *        (see mm_create and mm_init_arenas)
+ * @param start - the start of the memory to manage
+ * @param size - the size of the memory to manage
+ * @param count - the number of arenas to split the memory into
+ * @param assignment - MM_ARENA_ROUND_ROBIN or MM_ARENA_BY_CPU
+ * @return the heap, or NULL if it cannot be created
+ */
+mm_heap_t *mm_create_arenas(void *start, int size, int count, int assignment)
+{
+    mm_heap_t *heap = (mm_heap_t *)calloc(1, sizeof(mm_heap_t));
+    if (heap == NULL)
+    {
+        return NULL;
+    }
+    pthread_mutex_init(&heap->lock, NULL);
+    pthread_mutex_init(&heap->buddy.lock, NULL);
+    if (!heap_init(heap, start, size, count, assignment, 0))
+    {
+        mm_heap_destroy(heap);
+        return NULL;
+    }
+    return heap;
+}
+
+/**
+ * @brief Destroy a heap created by mm_create, all its allocated spaces and pools become invalid
+ *        NOTE: no other thread may be using the heap
+ * @param heap - the heap to destroy
+ */
+void mm_heap_destroy(mm_heap_t *heap)
+{
+    if (heap == NULL)
+    {
+        return;
+    }
+    heap_destroy(heap);
+    pthread_mutex_destroy(&heap->buddy.lock);
+    pthread_mutex_destroy(&heap->lock);
+    free(heap);
+}
+
+/**
+ * @brief Create a heap over memory it maps itself (see mm_init_mapped)
+ * @param reserve - the bytes of address space to reserve
+ * @param flags - MM_MAP_HUGETLB and/or MM_MAP_THP, or 0 for normal pages
+ * @return the heap, or NULL if it cannot be created
+ */
+mm_heap_t *mm_create_mapped(int reserve, int flags)
+{
+    mm_heap_t *heap = (mm_heap_t *)calloc(1, sizeof(mm_heap_t));
+    if (heap == NULL)
+    {
+        return NULL;
+    }
+    pthread_mutex_init(&heap->lock, NULL);
+    pthread_mutex_init(&heap->buddy.lock, NULL);
+    if (!heap_init_mapped(heap, reserve, flags))
+    {
+        mm_heap_destroy(heap);
+        return NULL;
+    }
+    return heap;
+}
+
+/**
+ * @brief Initialize the memory manager to "manage" the given location
+ *        NOTE: Do NOT malloc space for the memory to manage
+ *              The invoker of this function will provide the memory
+ *              See the sample for how to use this function
+ * @param start - the start of the memory to manage
+ * @param size - the size of the memory to manage
+ * @return 0 if the memory manager was initialized
+ * @return -1 if its bookkeeping could not be allocated
+ */
+int mm_init(void *start, int size)
+{
+    return mm_init_arenas(start, size, 1, MM_ARENA_ROUND_ROBIN);
+}
+
+/**
+ * @brief Initialize the memory manager to "manage" the given location as
+ *        count independent arenas, each with its own lock and free blocks
+ *        NOTE: a single allocation can never span two arenas
+ * @param start - the start of the memory to manage
+ * @param size - the size of the memory to manage
+ * @param count - the number of arenas to split the memory into
+ * @param assignment - MM_ARENA_ROUND_ROBIN or MM_ARENA_BY_CPU
+ * @return 0 if the memory manager was initialized
+ * @return -1 if its bookkeeping could not be allocated
+ */
+int mm_init_arenas(void *start, int size, int count, int assignment)
+{
+    return heap_init(&default_heap, start, size, count, assignment, 0) ? 0 : -1;
+}
+
+/**
+ * @brief Initialize the memory manager over memory it maps itself instead of a caller
+ *        provided buffer: reserve bytes of address space are reserved, but pages are only
+ *        committed (in chunks) as allocations reach them, and idle pages at the end of
+ *        the heap are given back to the system, so starting a large heap is cheap and
+ *        its resident size follows its use
+ *        The space counts as managed from the start (get_remaining_space includes the
+ *        uncommitted part), the mapping is released by mm_destroy
+ * @param reserve - the bytes of address space to reserve (rounded up to whole chunks)
+ * @param flags - MM_MAP_HUGETLB and/or MM_MAP_THP, or 0 for normal pages
+ * @return 0 if the memory was reserved
+ * @return -1 if the system refused the reservation or the bookkeeping could not be allocated
+ */
+int mm_init_mapped(int reserve, int flags)
+{
+    return heap_init_mapped(&default_heap, reserve, flags) ? 0 : -1;
+}
+
+// Memory Manager Cleanup
+/**
+ * @brief Cleans up any storage used by the memory manager
+ *        After a call to mmDestroy:
+ *            all allocated spaces become invalid
+ *            future allocation attempts fail
+ *            future frees result in segmentation faults
+ *        NOTE: after a call to mmDestroy a call to mmInit
+ *            reinitializes the memory manager to allow allocations
+ *            and frees
+ */
+void mm_destroy()
+{
+    heap_destroy(&default_heap);
+}
+
+/**
+ * @brief Requests a block of memory from a heap using first fit placement algorithm
+ * @param heap - the heap to allocate from
+ * @param nbytes - the number of bytes in the requested memory
+ * @return a pointer to the start of the allocated space
+ */
+void *mm_heap_alloc_ff(mm_heap_t *heap, int nbytes)
+{
+    // Find the lowest addressed free block that can accommodate the requested size
+    void *ptr = place(heap, index_first_fit, nbytes, MM_DEFAULT_ALIGNMENT);
+    record_call(heap, MM_TRACE_FF, nbytes, MM_DEFAULT_ALIGNMENT, ptr, NULL);
+    return ptr;
+}
+
+/**
+ * @brief Requests a block of memory from a heap using worst fit placement algorithm
+ * @param heap - the heap to allocate from
+ * @param nbytes - the number of bytes in the requested memory
+ * @return a pointer to the start of the allocated space
+ */
+void *mm_heap_alloc_wf(mm_heap_t *heap, int nbytes)
+{
+    // Find the largest free block that can accommodate the requested size
+    void *ptr = place(heap, index_worst_fit, nbytes, MM_DEFAULT_ALIGNMENT);
+    record_call(heap, MM_TRACE_WF, nbytes, MM_DEFAULT_ALIGNMENT, ptr, NULL);
+    return ptr;
+}
+
+/**
+ * @brief Requests a block of memory from a heap using best fit placement algorithm
+ * @param heap - the heap to allocate from
+ * @param nbytes - the number of bytes in the requested memory
+ * @return a pointer to the start of the allocated space
+ */
+void *mm_heap_alloc_bf(mm_heap_t *heap, int nbytes)
+{
+    // Find the smallest free block that can accommodate the requested size
+    void *ptr = place(heap, index_best_fit, nbytes, MM_DEFAULT_ALIGNMENT);
+    record_call(heap, MM_TRACE_BF, nbytes, MM_DEFAULT_ALIGNMENT, ptr, NULL);
+    return ptr;
+}
+
+/**
+ * @brief Requests a block of memory from a heap using next fit placement algorithm
+ *        Every arena of the heap keeps its own position
+ * @param heap - the heap to allocate from
+ * @param nbytes - the number of bytes in the requested memory
+ * @return a pointer to the start of the allocated space
+ */
+void *mm_heap_alloc_nf(mm_heap_t *heap, int nbytes)
+{
+    // Find the first free block after the rover that can accommodate the requested size
+    void *ptr = place(heap, index_next_fit, nbytes, MM_DEFAULT_ALIGNMENT);
+    record_call(heap, MM_TRACE_NF, nbytes, MM_DEFAULT_ALIGNMENT, ptr, NULL);
+    return ptr;
+}
+
+/**
+ * @brief Requests a block of memory from a heap whose start is a multiple of alignment
+ *        (see mymalloc_aligned)
+ * @param heap - the heap to allocate from
+ * @param nbytes - the number of bytes in the requested memory
+ * @param alignment - the required alignment, a power of two
+ * @return a pointer to the start of the allocated space, or NULL if alignment is not a power of two
+ */
+void *mm_heap_alloc_aligned(mm_heap_t *heap, int nbytes, int alignment)
+{
+    if (alignment <= 0 || (alignment & (alignment - 1)) != 0)
+    {
+        return NULL;
+    }
+    if (alignment < MM_DEFAULT_ALIGNMENT)
+    {
+        alignment = MM_DEFAULT_ALIGNMENT;
+    }
+
+    // Find the lowest addressed free block that still fits once its start is aligned
+    void *ptr = place(heap, index_first_fit, nbytes, alignment);
+    record_call(heap, MM_TRACE_ALIGNED, nbytes, alignment, ptr, NULL);
+    return ptr;
+}
+
+/**
+ * @brief Requests a block of memory be allocated using first fit placement algorithm
+ *        The memory manager must be initialized (mm_init) for this call to succeed
+ * @param nbytes - the number of bytes in the requested memory
+ * @return a pointer to the start of the allocated space
+ */
+void *mymalloc_ff(int nbytes)
+{
+    return mm_heap_alloc_ff(&default_heap, nbytes);
+}
+
+/**
+ * @brief Requests a block of memory be allocated using worst fit placement algorithm
+ *        The memory manager must be initialized (mm_init) for this call to succeed
+ * @param nbytes - the number of bytes in the requested memory
+ * @return a pointer to the start of the allocated space
+ */
+void *mymalloc_wf(int nbytes)
+{
+    return mm_heap_alloc_wf(&default_heap, nbytes);
+}
+
+/**
+ * @brief Requests a block of memory be allocated using best fit placement algorithm
+ *        The memory manager must be initialized (mm_init) for this call to succeed
+ * @param nbytes - the number of bytes in the requested memory
+ * @return a pointer to the start of the allocated space
+ */
+void *mymalloc_bf(int nbytes)
+{
+    return mm_heap_alloc_bf(&default_heap, nbytes);
+}
+
+/**
+ * @brief Requests a block of memory be allocated using next fit placement algorithm
+ *        The search resumes where the previous next fit search ended and wraps around
+ *        The memory manager must be initialized (mm_init) for this call to succeed
+ * @param nbytes - the number of bytes in the requested memory
+ * @return a pointer to the start of the allocated space
+ */
+void *mymalloc_nf(int nbytes)
+{
+    return mm_heap_alloc_nf(&default_heap, nbytes);
+}
+
+/**
+ * @brief Requests a block of memory whose start is a multiple of alignment (first fit placement)
+ *        The memory manager must be initialized (mm_init) for this call to succeed
+ *        Alignments below MM_DEFAULT_ALIGNMENT are raised to it, use 64 for a cache line
+ *        and 4096 for a page
+ * @param nbytes - the number of bytes in the requested memory
+ * @param alignment - the required alignment, a power of two
+ * @return a pointer to the start of the allocated space, or NULL if alignment is not a power of two
+ */
+void *mymalloc_aligned(int nbytes, int alignment)
+{
+    return mm_heap_alloc_aligned(&default_heap, nbytes, alignment);
+}
+
+/**
+ * @brief Reserve part of a heap for its buddy allocator (see mm_buddy_init)
+ * @param heap - the heap to reserve the zone in
+ * @param size - the size of the zone, rounded down to a power of two
+ * @return 0 if the zone was reserved
+ * @return -1 if a zone already exists or there is no free block large enough
+ */
+int mm_heap_buddy_init(mm_heap_t *heap, int size)
+{
+    int order = BUDDY_MIN_ORDER;
+    while (order < BUDDY_MAX_ORDER && (2 << order) <= size)
+    {
+        order++;
+    }
+    if (heap->arenas == NULL || size < (1 << BUDDY_MIN_ORDER))
+    {
+        return -1;
+    }
+
+    pthread_mutex_lock(&heap->buddy.lock);
+    bool reserved = heap->buddy.start == NULL && buddy_reserve(heap, order);
+    pthread_mutex_unlock(&heap->buddy.lock);
+    return reserved ? 0 : -1;
+}
+
+/**
+ * @brief Reserve part of the managed space for the buddy allocator (mymalloc_buddy)
+ *        The memory manager must be initialized (mm_init) for this call to succeed
+ *        Only one zone can exist, it is released by mm_destroy
+ * @param size - the size of the zone, rounded down to a power of two
+ * @return 0 if the zone was reserved
+ * @return -1 if a zone already exists or there is no free block large enough
+ */
+int mm_buddy_init(int size)
+{
+    return mm_heap_buddy_init(&default_heap, size);
+}
+
+// Allocate a power of two block from the buddy zone of the heap
+static void *buddy_alloc(mm_heap_t *heap, int nbytes)
+{
+    BuddyZone *buddy = &heap->buddy;
+    if (heap->arenas == NULL || nbytes < 0)
+    {
+        return NULL;
+    }
+    int order = BUDDY_MIN_ORDER;
+    while (order < BUDDY_MAX_ORDER && (1 << order) < nbytes)
+    {
+        order++;
+    }
+    if ((1 << order) < nbytes)
+    {
+        return NULL; // Larger than any zone
+    }
+
+    pthread_mutex_lock(&buddy->lock);
+    if (buddy->start == NULL)
+    {
+        int zone_order = buddy_default_order(heap);
+        if (zone_order < 0 || !buddy_reserve(heap, zone_order))
+        {
+            pthread_mutex_unlock(&buddy->lock);
+            return NULL;
+        }
+    }
+
+    // Smallest order with a free block that is big enough
+    int found = order;
+    while (found <= buddy->order && buddy->free_lists[found] == NULL)
+    {
+        found++;
+    }
+    if (found > buddy->order)
+    {
+        pthread_mutex_unlock(&buddy->lock);
+        return NULL; // No suitable free block found
+    }
+    char *block = (char *)buddy->free_lists[found];
+    buddy_unlink(buddy, block, found);
+
+    // Split down to the requested order, the upper halves become free buddies
+    while (found > order)
+    {
+        bit_set(buddy->split, buddy_node(buddy, block, found), true);
+        stat_add_long(&buddy->splits, 1);
+        found--;
+        buddy_push(buddy, block + (1 << found), found);
+    }
+    bit_set(buddy->allocated, buddy_node(buddy, block, order), true);
+    stat_add(&buddy->allocated_bytes, 1 << order);
+    pthread_mutex_unlock(&buddy->lock);
+
+    __atomic_fetch_add(&heap->malloc_count, 1, __ATOMIC_RELAXED);
+    return block;
+}
+
+/**
+ * @brief Requests a block of memory from the buddy zone of a heap (see mymalloc_buddy)
+ * @param heap - the heap to allocate from
+ * @param nbytes - the number of bytes in the requested memory
+ * @return a pointer to the start of the allocated space
+ */
+void *mm_heap_alloc_buddy(mm_heap_t *heap, int nbytes)
+{
+    void *ptr = buddy_alloc(heap, nbytes);
+    record_call(heap, MM_TRACE_BUDDY, nbytes, 0, ptr, NULL);
+    return ptr;
+}
+
+/**
+ * @brief Requests a block of memory be allocated using the binary buddy system
+ *        The block is rounded up to a power of two (at least 16 bytes) and
+ *        taken from the buddy zone, which is reserved on first use from the
+ *        largest free block if mm_buddy_init was not called
+ *        The memory manager must be initialized (mm_init) for this call to succeed
+ * @param nbytes - the number of bytes in the requested memory
+ * @return a pointer to the start of the allocated space
+ */
+void *mymalloc_buddy(int nbytes)
+{
+    return mm_heap_alloc_buddy(&default_heap, nbytes);
+}
+
+// Carve a pool slab straight out of the arenas, as buddy_reserve does, so it
+// skips the thread cache and is neither counted nor traced as a user call
+static char *pool_slab_take(mm_heap_t *heap, int nbytes)
+{
+    char *slab = NULL;
+    for (int i = 0; slab == NULL && i < heap->arena_count; i++)
+    {
+        pthread_mutex_lock(&heap->arenas[i].lock);
+        Node *block = find_block(&heap->arenas[i], index_first_fit, nbytes, POOL_ALIGNMENT);
+        if (block != NULL)
+        {
+            slab = allocate_memory(&heap->arenas[i], block, nbytes, POOL_ALIGNMENT);
+        }
+        pthread_mutex_unlock(&heap->arenas[i].lock);
+    }
+    return slab;
+}
+
+// Return a pool slab to its arena, bypassing the thread cache
+static void pool_slab_release(mm_heap_t *heap, char *slab)
+{
+    Arena *arena = arena_of(heap, slab);
+    if (arena == NULL)
+    {
+        invalid_free(); // The heap was destroyed under the pool
+    }
+    pthread_mutex_lock(&arena->lock);
+    Node *block = hash_find(arena, slab);
+    if (block == NULL)
+    {
+        pthread_mutex_unlock(&arena->lock);
+        invalid_free(); // Pool destroyed twice
+    }
+    release_block(arena, block);
+    pthread_mutex_unlock(&arena->lock);
+}
+
+/**
+ * @brief Create a pool of count objects of obj_size bytes, carved as one
+ *        contiguous slab out of a heap (first fit)
+ * @param heap - the heap to carve the slab out of
+ * @param obj_size - the size of each object
+ * @param count - the number of objects in the pool
+ * @return the pool, or NULL if there is no free block large enough
+ */
+mm_pool_t *mm_heap_pool_create(mm_heap_t *heap, int obj_size, int count)
+{
+    if (obj_size <= 0 || count <= 0)
+    {
+        return NULL;
+    }
+
+    // Objects are aligned and large enough to hold the free list link
+    long long rounded = ((long long)obj_size + POOL_ALIGNMENT - 1) / POOL_ALIGNMENT * POOL_ALIGNMENT;
+    long long header = ((long long)sizeof(struct mm_pool) + (count + 7) / 8 + POOL_ALIGNMENT - 1) /
+                       POOL_ALIGNMENT * POOL_ALIGNMENT;
+    long long total = header + rounded * count;
+    if (total > INT_MAX)
+    {
+        return NULL;
+    }
+
+    char *slab = pool_slab_take(heap, (int)total);
+    if (slab == NULL)
+    {
+        return NULL;
+    }
+
+    struct mm_pool *pool = (struct mm_pool *)slab;
+    pool->heap = heap;
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->slab = slab;
+    pool->objects = (char *)pool + header;
+    pool->obj_size = (int)rounded;
+    pool->count = count;
+    pool->live = 0;
+    pool->live_map = (unsigned char *)(pool + 1);
+    memset(pool->live_map, 0, (count + 7) / 8);
+
+    // Chain the objects so the lowest address is handed out first
+    pool->free_list = NULL;
+    for (int i = count - 1; i >= 0; i--)
+    {
+        void **object = (void **)(pool->objects + (long long)i * pool->obj_size);
+        *object = pool->free_list;
+        pool->free_list = object;
+    }
+
+    __atomic_fetch_add(&heap->pool_slab_bytes, (int)(rounded * count), __ATOMIC_RELAXED);
+    return pool;
+}
+
+/**
+ * @brief Create a pool of count objects of obj_size bytes, carved as one
+ *        contiguous slab out of the managed space (first fit)
+ *        The memory manager must be initialized (mm_init) for this call to succeed
+ * @param obj_size - the size of each object
+ * @param count - the number of objects in the pool
+ * @return the pool, or NULL if there is no free block large enough
+ */
+mm_pool_t *mm_pool_create(int obj_size, int count)
+{
+    return mm_heap_pool_create(&default_heap, obj_size, count);
+}
+
+/**
+ * @brief Allocate one object from a pool in constant time
+ * @param pool - the pool to allocate from
+ * @return a pointer to the object, or NULL if the pool is exhausted
+ */
+void *mm_pool_alloc(mm_pool_t *pool)
+{
+    if (pool == NULL)
+    {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    void **object = (void **)pool->free_list;
+    if (object == NULL)
+    {
+        pthread_mutex_unlock(&pool->lock);
+        return NULL; // Pool exhausted
+    }
+    pool->free_list = *object;
+    pool->live++;
+    bit_set(pool->live_map, (int)(((char *)object - pool->objects) / pool->obj_size), true);
+    pthread_mutex_unlock(&pool->lock);
+
+    __atomic_fetch_add(&pool->heap->pool_allocated_bytes, pool->obj_size, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&pool->heap->malloc_count, 1, __ATOMIC_RELAXED);
+    return object;
+}
+
+/**
+ * @brief Return an object to its pool in constant time
+ *        Signals a SIGSEGV (like myfree) if ptr is not a live object of the pool
+ * @param pool - the pool the object was allocated from
+ * @param ptr - the object to free
+ */
+void mm_pool_free(mm_pool_t *pool, void *ptr)
+{
+    if (ptr == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    long long offset = (char *)ptr - pool->objects;
+    int index = (int)(offset / pool->obj_size);
+    if (offset < 0 || offset % pool->obj_size != 0 || index >= pool->count || !bit_test(pool->live_map, index))
+    {
+        pthread_mutex_unlock(&pool->lock);
+        invalid_free(); // Not a live object of this pool (e.g. double free)
+    }
+    bit_set(pool->live_map, index, false);
+    *(void **)ptr = pool->free_list;
+    pool->free_list = ptr;
+    pool->live--;
+    pthread_mutex_unlock(&pool->lock);
+
+    __atomic_fetch_sub(&pool->heap->pool_allocated_bytes, pool->obj_size, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Destroy a pool and return its slab to the heap it was carved out of
+ *        All objects of the pool become invalid
+ * @param pool - the pool to destroy
+ */
+void mm_pool_destroy(mm_pool_t *pool)
+{
+    if (pool == NULL)
+    {
+        return;
+    }
+    mm_heap_t *heap = pool->heap;
+    __atomic_fetch_sub(&heap->pool_allocated_bytes, pool->live * pool->obj_size, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&heap->pool_slab_bytes, pool->count * pool->obj_size, __ATOMIC_RELAXED);
+    pthread_mutex_destroy(&pool->lock);
+    pool_slab_release(heap, pool->slab);
+}
+
+// Take an unused handle from the heap's slabs (NULL if none is left and no slab can be added)
+static mm_handle_t *handle_new(mm_heap_t *heap)
+{
+    pthread_mutex_lock(&heap->lock);
+    if (heap->free_handles == NULL)
+    {
+        HandleSlab *slab = (HandleSlab *)calloc(1, sizeof(HandleSlab));
+        if (slab == NULL)
+        {
+            pthread_mutex_unlock(&heap->lock);
+            return NULL;
+        }
+        slab->next = heap->handle_slabs;
+        heap->handle_slabs = slab;
+        for (int i = 0; i < HANDLE_SLAB_HANDLES; i++)
+        {
+            slab->handles[i].next = heap->free_handles;
+            heap->free_handles = &slab->handles[i];
+        }
+    }
+    mm_handle_t *handle = heap->free_handles;
+    heap->free_handles = handle->next;
+    pthread_mutex_unlock(&heap->lock);
+    return handle;
+}
+
+static void handle_release(mm_handle_t *handle)
+{
+    mm_heap_t *heap = handle->heap;
+    pthread_mutex_lock(&heap->lock);
+    handle->ptr = NULL;
+    handle->next = heap->free_handles;
+    heap->free_handles = handle;
+    pthread_mutex_unlock(&heap->lock);
+}
+
+/**
+ * @brief Requests a relocatable block of memory from a heap (see mm_handle_alloc)
+ * @param heap - the heap to allocate from
+ * @param nbytes - the number of bytes in the requested memory
+ * @return the handle of the block, or NULL if there is no free block large enough
+ */
+mm_handle_t *mm_heap_handle_alloc(mm_heap_t *heap, int nbytes)
+{
+    if (heap->arenas == NULL || nbytes < 0 || nbytes > INT_MAX - MM_DEFAULT_ALIGNMENT)
+    {
+        return NULL;
+    }
+    mm_handle_t *handle = handle_new(heap);
+    if (handle == NULL)
+    {
+        return NULL;
+    }
+
+    // Whole multiples of the alignment, so a block that slides down leaves no slack behind
+    int rounded = (nbytes + MM_DEFAULT_ALIGNMENT - 1) / MM_DEFAULT_ALIGNMENT * MM_DEFAULT_ALIGNMENT;
+    int home = pick_home_arena(heap);
+    for (int i = 0; i < heap->arena_count; i++)
+    {
+        // Bypasses the thread cache, relocatable blocks are never owned by a thread
+        Arena *arena = &heap->arenas[(home + i) % heap->arena_count];
+        void *ptr = arena_alloc(arena, index_first_fit, rounded, MM_DEFAULT_ALIGNMENT, NULL);
+        if (ptr != NULL)
+        {
+            pthread_mutex_lock(&arena->lock);
+            handle->ptr = ptr;
+            handle->size = nbytes;
+            handle->pins = 0;
+            handle->arena = arena;
+            handle->heap = heap;
+            hash_find(arena, ptr)->handle = handle;
+            pthread_mutex_unlock(&arena->lock);
+            __atomic_fetch_add(&heap->malloc_count, 1, __ATOMIC_RELAXED);
+            return handle;
+        }
+    }
+    handle->heap = heap;
+    handle_release(handle);
+    return NULL;
+}
+
+/**
+ * @brief Requests a relocatable block of memory (first fit placement)
+ *        The block may be moved by mm_compact whenever it is not pinned, so it is only
+ *        reached through mm_pin, and must be freed with mm_handle_free (not myfree)
+ *        Handles are not recorded by mm_trace_start
+ *        The memory manager must be initialized (mm_init) for this call to succeed
+ * @param nbytes - the number of bytes in the requested memory
+ * @return the handle of the block, or NULL if there is no free block large enough
+ */
+mm_handle_t *mm_handle_alloc(int nbytes)
+{
+    return mm_heap_handle_alloc(&default_heap, nbytes);
+}
+
+/**
+ * @brief Free a relocatable block and its handle
+ *        Signals a SIGSEGV (like myfree) if the handle was already freed
+ * @param handle - the handle to free
+ */
+void mm_handle_free(mm_handle_t *handle)
+{
+    if (handle == NULL)
+    {
+        return;
+    }
+    Arena *arena = handle->arena;
+    pthread_mutex_lock(&arena->lock);
+    Node *block = handle->ptr == NULL ? NULL : hash_find(arena, handle->ptr);
+    if (block == NULL || block->handle != handle)
+    {
+        pthread_mutex_unlock(&arena->lock);
+        invalid_free(); // Already freed
+    }
+    block->handle = NULL;
+    release_block(arena, block);
+    pthread_mutex_unlock(&arena->lock);
+    handle_release(handle);
+}
+
+/**
+ * @brief Pin a relocatable block so it cannot move and get its current address
+ *        Pins nest, the block may move again once every pin has been undone with mm_unpin
+ * @param handle - the handle of the block
+ * @return the start of the block, valid until the matching mm_unpin
+ */
+void *mm_pin(mm_handle_t *handle)
+{
+    pthread_mutex_lock(&handle->arena->lock);
+    handle->pins++;
+    void *ptr = handle->ptr;
+    pthread_mutex_unlock(&handle->arena->lock);
+    return ptr;
+}
+
+/**
+ * @brief Undo one mm_pin, the address it returned must no longer be used
+ * @param handle - the handle of the block
+ */
+void mm_unpin(mm_handle_t *handle)
+{
+    pthread_mutex_lock(&handle->arena->lock);
+    if (handle->pins > 0)
+    {
+        handle->pins--;
+    }
+    pthread_mutex_unlock(&handle->arena->lock);
+}
+
+/**
+ * @brief Retrieve the size a relocatable block was requested with
+ * @param handle - the handle of the block
+ * @return the size in bytes
+ */
+int mm_handle_size(mm_handle_t *handle)
+{
+    return handle->size;
+}
+
+/**
+ * @brief Compact a heap for at most budget_us microseconds (see mm_compact)
+ * @param heap - the heap to compact
+ * @param budget_us - the time budget in microseconds, 0 for no limit
+ * @return 1 if the pass reached the end of the heap, 0 if the budget ran out first
+ */
+int mm_heap_compact(mm_heap_t *heap, int budget_us)
+{
+    long long deadline = budget_us > 0 ? trace_clock() + budget_us * 1000LL : 0;
+    pthread_mutex_lock(&heap->lock);
+    while (heap->compact_arena < heap->arena_count)
+    {
+        // Every step takes the arena lock on its own so allocations are never held up for long
+        Arena *arena = &heap->arenas[heap->compact_arena];
+        pthread_mutex_lock(&arena->lock);
+        bool swept = compact_step(arena);
+        pthread_mutex_unlock(&arena->lock);
+        if (swept)
+        {
+            heap->compact_arena++;
+        }
+        if (deadline != 0 && trace_clock() >= deadline)
+        {
+            break;
+        }
+    }
+    bool finished = heap->compact_arena >= heap->arena_count;
+    if (finished)
+    {
+        heap->compact_arena = 0; // The next call starts a new pass
+    }
+    pthread_mutex_unlock(&heap->lock);
+    return finished ? 1 : 0;
+}
+
+/**
+ * @brief Slide relocatable blocks down over the free space in front of them, so the free
+ *        space gathers into one block at the end of each arena (as far as pinned and
+ *        ordinary blocks, which never move, allow)
+ *        The work is done in small steps, each holding an arena lock only briefly, and
+ *        stops once the budget is used up: call again to continue where it stopped
+ *        NOTE: data of unpinned relocatable blocks may move while this runs
+ * @param budget_us - the time budget in microseconds, 0 for no limit
+ * @return 1 if the pass reached the end of the heap, 0 if the budget ran out first
+ */
+int mm_compact(int budget_us)
+{
+    return mm_heap_compact(&default_heap, budget_us);
+}
+
+// Free a block handed out by any of the heap's allocators except the pools
+static void release(mm_heap_t *heap, void *ptr)
+{
+    if (in_buddy_zone(&heap->buddy, ptr))
+    {
+        buddy_free(&heap->buddy, ptr);
+        return;
+    }
+
+    Arena *arena = arena_of(heap, ptr);
+    if (arena == NULL)
+    {
+        invalid_free(); // Not initialized, destroyed or not a managed address
+    }
+
+    TCache *cache = tcache_get(heap, false);
+    if (cache != NULL && (stat_read(&heap->tcache_limit) > 0 || cache->cached_bytes > 0) && tcache_free(cache, ptr))
+    {
+        return; // Kept in this thread's cache
+    }
 
-// Global mutex
-pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    pthread_mutex_lock(&arena->lock);
+    Node *curr = hash_find(arena, ptr);
+    if (curr == NULL || curr->quick || curr->handle != NULL || __atomic_load_n(&curr->cached, __ATOMIC_ACQUIRE))
+    {
+        pthread_mutex_unlock(&arena->lock);
+        // Error: Pointer is not an allocated block (e.g. double free) or belongs to a handle
+        invalid_free();
+    }
+    release_block(arena, curr);
+    pthread_mutex_unlock(&arena->lock);
+}
 
-// Data Structure for Memory Block
-typedef struct Node
+/**
+ * @brief Requests a block of memory be returned to the heap it was allocated from
+ *        Signals a SIGSEGV if ptr is not an allocated block of the heap (see myfree)
+ * @param heap - the heap the block was allocated from
+ * @param ptr - a pointer to the start of the space to be freed
+ */
+void mm_heap_free(mm_heap_t *heap, void *ptr)
 {
-    void *start;       // Start address of the block
-    int size;          // Size of the block
-    int allocated;     // Flag indicating if the block is allocated
-    struct Node *next; // Pointer to the next block in the list
-} Node;
+    if (ptr == NULL)
+    {
+        return; // Invalid pointer
+    }
+    // Recorded first so the record precedes any reuse of the block by another thread
+    record_call(heap, MM_TRACE_FREE, 0, 0, NULL, ptr);
+    release(heap, ptr);
+}
 
-// Global Variables
-static Node *memory_list = NULL;
+// Memory Deallocation
+/**
+ * @brief Requests a block of memory be freed and the storage made available for future allocations
+ *        The memory manager must be initialized (mm_init) for this call to succeed
+ * @param ptr - a pointer to the start of the space to be freed
+ *        Signals a SIGSEGV if a free is not valid
+ *            - memory manager is not initialized
+ *            - memory manager has been destroyed
+ *            - ptr is not allocated (e.g. double free)
+ */
+void myfree(void *ptr)
+{
+    mm_heap_free(&default_heap, ptr);
+}
 
-// Helper Function
-static Node *find_free_block(int nbytes)
+// Resize an allocated block of the heap, moving it if it cannot grow in place
+static void *reallocate(mm_heap_t *heap, void *ptr, int nbytes)
 {
-    Node *curr = memory_list;
-    while (curr != NULL)
+    BuddyZone *buddy = &heap->buddy;
+    int old_size;
+    if (in_buddy_zone(buddy, ptr))
     {
-        if (!curr->allocated && curr->size >= nbytes)
+        // Buddy blocks keep their power of two size, so only a larger request moves
+        pthread_mutex_lock(&buddy->lock);
+        int node;
+        int order = buddy_lookup(buddy, ptr, &node);
+        pthread_mutex_unlock(&buddy->lock);
+        if (order < 0)
+        {
+            invalid_free(); // Not the start of an allocated buddy block
+        }
+        if (nbytes <= 1 << order)
+        {
+            return ptr;
+        }
+        old_size = 1 << order;
+        void *new_ptr = buddy_alloc(heap, nbytes);
+        if (new_ptr == NULL)
         {
-            return curr;
+            return NULL;
         }
-        curr = curr->next;
+        memcpy(new_ptr, ptr, old_size);
+        buddy_free(buddy, ptr);
+        __atomic_fetch_sub(&heap->malloc_count, 1, __ATOMIC_RELAXED); // Not a new allocation
+        return new_ptr;
     }
-    return NULL;
+
+    Arena *arena = arena_of(heap, ptr);
+    if (arena == NULL)
+    {
+        invalid_free(); // Not initialized, destroyed or not a managed address
+    }
+    pthread_mutex_lock(&arena->lock);
+    Node *curr = hash_find(arena, ptr);
+    if (curr == NULL || curr->quick || curr->handle != NULL || __atomic_load_n(&curr->cached, __ATOMIC_ACQUIRE))
+    {
+        pthread_mutex_unlock(&arena->lock);
+        invalid_free(); // Not an allocated block (e.g. already freed) or belongs to a handle
+    }
+    bool resized = resize_in_place(arena, curr, nbytes);
+    old_size = curr->size;
+    pthread_mutex_unlock(&arena->lock);
+    if (resized)
+    {
+        return ptr;
+    }
+
+    // Last resort: move the contents to a new block
+    void *new_ptr = place(heap, index_first_fit, nbytes, MM_DEFAULT_ALIGNMENT);
+    if (new_ptr == NULL)
+    {
+        return NULL;
+    }
+    memcpy(new_ptr, ptr, old_size);
+    release(heap, ptr);
+    __atomic_fetch_sub(&heap->malloc_count, 1, __ATOMIC_RELAXED); // Not a new allocation
+    return new_ptr;
 }
 
-void *allocate_memory(Node *block, int nbytes)
+/**
+ * @brief Change the size of a block allocated from a heap (see myrealloc)
+ * @param heap - the heap the block was allocated from
+ * @param ptr - a pointer to the start of the allocated space (NULL to allocate)
+ * @param nbytes - the new size in bytes (0 to free)
+ * @return a pointer to the start of the resized space, or NULL if there is no room (ptr stays valid)
+ */
+void *mm_heap_realloc(mm_heap_t *heap, void *ptr, int nbytes)
 {
-    if (block->size > nbytes)
+    if (ptr == NULL)
+    {
+        return mm_heap_alloc_ff(heap, nbytes);
+    }
+    if (nbytes <= 0)
     {
-        // Split the block into two
-        Node *new_block = (Node *)malloc(sizeof(Node));
-        new_block->start = block->start + nbytes;
-        new_block->size = block->size - nbytes;
-        new_block->allocated = 0;
-        new_block->next = block->next;
-        block->next = new_block;
-        block->size = nbytes;
+        mm_heap_free(heap, ptr);
+        return NULL;
     }
+    void *new_ptr = reallocate(heap, ptr, nbytes);
+    record_call(heap, MM_TRACE_REALLOC, nbytes, 0, new_ptr, ptr);
+    return new_ptr;
+}
 
-    // Allocate from the block
-    block->allocated = 1;
-    allocation_count++;
+/**
+ * @brief Change the size of an allocated block, keeping its contents up to the smaller size
+ *        The block is resized in place when possible: shrinking returns the tail to the
+ *        free space and growing absorbs the following free block
+ *        Otherwise a new block is allocated (first fit), the contents copied and the old block freed
+ *        The memory manager must be initialized (mm_init) for this call to succeed
+ * @param ptr - a pointer to the start of the allocated space (NULL to allocate)
+ * @param nbytes - the new size in bytes (0 to free)
+ * @return a pointer to the start of the resized space, or NULL if there is no room (ptr stays valid)
+ *         Signals a SIGSEGV if ptr is not allocated, like myfree
+ */
+void *myrealloc(void *ptr, int nbytes)
+{
+    return mm_heap_realloc(&default_heap, ptr, nbytes);
+}
 
-    // Return the start address of the allocated block
-    return block->start;
+static int heap_allocated_space(mm_heap_t *heap)
+{
+    int allocated_space = 0;
+    for (int i = 0; i < heap->arena_count; i++)
+    {
+        allocated_space += stat_read(&heap->arenas[i].allocated_bytes);
+    }
+
+    // Buddy zones and pool slabs count by their own blocks rather than as one allocation
+    allocated_space += stat_read(&heap->buddy.allocated_bytes) - stat_read(&heap->buddy.zone_bytes);
+    allocated_space += stat_read(&heap->pool_allocated_bytes) - stat_read(&heap->pool_slab_bytes);
+    return allocated_space;
+}
+
+static int heap_remaining_space(mm_heap_t *heap)
+{
+    int free_space = 0;
+    for (int i = 0; i < heap->arena_count; i++)
+    {
+        free_space += stat_read(&heap->arenas[i].free_bytes);
+    }
+    free_space += stat_read(&heap->buddy.free_bytes);
+    free_space += stat_read(&heap->pool_slab_bytes) - stat_read(&heap->pool_allocated_bytes);
+    return free_space;
+}
+
+static int heap_fragment_count(mm_heap_t *heap)
+{
+    int fragment_count = 0;
+    for (int i = 0; i < heap->arena_count; i++)
+    {
+        fragment_count += stat_read(&heap->arenas[i].fragment_count);
+    }
+    fragment_count += stat_read(&heap->buddy.fragment_count);
+    return fragment_count;
+}
+
+static long long heap_search_steps(mm_heap_t *heap)
+{
+    long long steps = 0;
+    for (int i = 0; i < heap->arena_count; i++)
+    {
+        steps += stat_read_long(&heap->arenas[i].search_steps);
+    }
+    return steps;
 }
 
+// Retrieve the current amount of space allocated by the memory manager
 /**
- * @brief Initialize the memory manager to "manage" the given location
- *        NOTE: Do NOT malloc space for the memory to manage
- *              The invoker of this function will provide the memory
- *              See the sample for how to use this function
- * @param start - the start of the memory to manage
- * @param size - the size of the memory to manage
+ * @brief Retrieve the current amount of space allocated by the memory manager (in bytes)
+ * @return the current number of allocated bytes
  */
-void mm_init(void *start, int size)
+int get_allocated_space()
 {
-    allocation_count = 0;
-    malloc_count = 0;
+    return heap_allocated_space(&default_heap);
+}
 
-    // Initialize memory list with the entire memory block as one free block
-    memory_list = (Node *)malloc(sizeof(Node));
-    memory_list->start = start;
-    memory_list->size = size;
-    memory_list->allocated = 0;
-    memory_list->next = NULL;
+// Retrieve the current amount of available space in the memory manager
+/**
+ * @brief Retrieve the current amount of available space in the memory manager (in bytes)
+ *        (e.g. sum of all free blocks)
+ * @return the current number of free bytes
+ */
+int get_remaining_space()
+{
+    return heap_remaining_space(&default_heap);
 }
 
-// Memory Manager Cleanup
+// Retrieve the current number of free blocks
 /**
- * @brief Cleans up any storage used by the memory manager
- *        After a call to mmDestroy:
- *            all allocated spaces become invalid
- *            future allocation attempts fail
- *            future frees result in segmentation faults
- *        NOTE: after a call to mmDestroy a call to mmInit
- *            reinitializes the memory manager to allow allocations
- *            and frees
+ * @brief Retrieve the current amount of free blocks (i.e. the count of all the block, not the size)
+ * @return the current number of free blocks
  */
-void mm_destroy()
+int get_fragment_count()
 {
-    // Free all nodes in the memory list
-    Node *curr = memory_list;
-    while (curr != NULL)
-    {
-        Node *temp = curr;
-        curr = curr->next;
-        free(temp);
-    }
-    memory_list = NULL;
+    return heap_fragment_count(&default_heap);
 }
 
 /**
- * @brief Requests a block of memory be allocated using first fit placement algorithm
- *        The memory manager must be initialized (mm_init) for this call to succeed
- * @param nbytes - the number of bytes in the requested memory
- * @return a pointer to the start of the allocated space
+ * @brief Retrieve the number of successful malloc calls (for all placement types)
+ * @return the total number of successful mallocs
  */
-void *mymalloc_ff(int nbytes)
+int get_mymalloc_count()
 {
-    Node *block = find_free_block(nbytes);
-    if (block == NULL)
-    {
-        return NULL; // No suitable free block found
-    }
+    return stat_read(&default_heap.malloc_count);
+}
 
-    return allocate_memory(block, nbytes);
+/**
+ * @brief Retrieve the number of free blocks examined by placement searches since mm_init
+ *        Dividing by get_mymalloc_count gives the average search length of a strategy
+ * @return the number of free index nodes visited
+ */
+long long get_search_steps()
+{
+    return heap_search_steps(&default_heap);
 }
 
 /**
- * @brief Requests a block of memory be allocated using worst fit placement algorithm
- *        The memory manager must be initialized (mm_init) for this call to succeed
- * @param nbytes - the number of bytes in the requested memory
- * @return a pointer to the start of the allocated space
+ * @brief Take a snapshot of the statistics of a heap (see mm_get_stats)
+ * @param heap - the heap to describe
+ * @param stats - filled in with the current statistics
  */
-void *mymalloc_wf(int nbytes)
+void mm_heap_get_stats(mm_heap_t *heap, struct mm_stats *stats)
 {
-    Node *block = NULL;
-    Node *curr = memory_list;
+    memset(stats, 0, sizeof(*stats));
+    stats->allocated_bytes = heap_allocated_space(heap);
+    stats->free_bytes = heap_remaining_space(heap);
+    stats->fragment_count = heap_fragment_count(heap);
+    stats->malloc_count = stat_read(&heap->malloc_count);
+    stats->search_steps = heap_search_steps(heap);
+    for (int i = 0; i < heap->arena_count; i++)
+    {
+        stats->quick_blocks += stat_read(&heap->arenas[i].quick_count);
+    }
 
-    // Find the largest free block that can accommodate the requested size
-    while (curr != NULL)
+    long long block_bytes = 0; // Free bytes held in free blocks (not idle pool objects)
+    for (int i = 0; i < heap->arena_count; i++)
     {
-        if (!curr->allocated && curr->size >= nbytes)
+        Arena *arena = &heap->arenas[i];
+        block_bytes += stat_read(&arena->free_bytes);
+        for (int b = 0; b < MM_STATS_BUCKETS; b++)
         {
-            if (block == NULL || curr->size > block->size)
-            {
-                block = curr;
-            }
+            stats->free_histogram[b] += stat_read(&arena->free_histogram[b]);
         }
-        curr = curr->next;
+        stats->splits += stat_read_long(&arena->splits);
+        stats->merges += stat_read_long(&arena->merges);
+        stats->relocations += stat_read_long(&arena->relocations);
+        stats->committed_bytes += stat_read(&arena->committed);
+        stats->trimmed_bytes += stat_read_long(&arena->trimmed_bytes);
+
+        int largest = stat_read(&arena->largest_free);
+        stats->largest_free = largest > stats->largest_free ? largest : stats->largest_free;
     }
 
-    if (block == NULL)
+    BuddyZone *buddy = &heap->buddy;
+    block_bytes += stat_read(&buddy->free_bytes);
+    for (int order = BUDDY_MIN_ORDER; order <= BUDDY_MAX_ORDER; order++)
     {
-        return NULL; // No suitable free block found
+        int count = stat_read(&buddy->free_counts[order]);
+        stats->free_histogram[size_bucket(1 << order)] += count;
+        if (count > 0 && (1 << order) > stats->largest_free)
+        {
+            stats->largest_free = 1 << order;
+        }
     }
+    stats->splits += stat_read_long(&buddy->splits);
+    stats->merges += stat_read_long(&buddy->merges);
 
-    return allocate_memory(block, nbytes);
+    stats->external_fragmentation = block_bytes > 0 ? 1.0 - (double)stats->largest_free / block_bytes : 0.0;
+    for (int op = 0; op < MM_TRACE_OPS; op++)
+    {
+        stats->calls[op] = __atomic_load_n(&heap->call_counts[op], __ATOMIC_RELAXED);
+    }
 }
 
 /**
- * @brief Requests a block of memory be allocated using best fit placement algorithm
- *        The memory manager must be initialized (mm_init) for this call to succeed
- * @param nbytes - the number of bytes in the requested memory
- * @return a pointer to the start of the allocated space
+ * @brief Take a snapshot of the heap statistics
+ *        Every value is kept up to date as blocks are allocated and freed, so this
+ *        takes no lock and never walks the blocks
+ *        NOTE: values are read one by one, a snapshot taken while other threads
+ *              allocate may be slightly inconsistent
+ * @param stats - filled in with the current statistics
  */
-void *mymalloc_bf(int nbytes)
+void mm_get_stats(struct mm_stats *stats)
 {
-    Node *block = NULL;
-    Node *curr = memory_list;
+    mm_heap_get_stats(&default_heap, stats);
+}
 
-    // Find the smallest free block that can accommodate the requested size
-    while (curr != NULL)
+/**
+ * @brief Visit every block of a heap in address order (see mm_walk)
+ * @param heap - the heap to walk
+ * @param callback - called with the start, size and allocated flag of each block,
+ *                   returning non zero stops the walk
+ * @param arg - passed through to the callback
+ * @return the value that stopped the walk, 0 if every block was visited
+ */
+int mm_heap_walk(mm_heap_t *heap, mm_walk_callback callback, void *arg)
+{
+    for (int i = 0; i < heap->arena_count; i++)
     {
-        if (!curr->allocated && curr->size >= nbytes)
+        Arena *arena = &heap->arenas[i];
+        pthread_mutex_lock(&arena->lock);
+        for (Node *block = arena->memory_list; block != NULL; block = block->next)
         {
-            if (block == NULL || curr->size < block->size)
+            int result = callback(block->start, block->size, block->allocated && !block->quick, arg);
+            if (result != 0)
             {
-                block = curr;
+                pthread_mutex_unlock(&arena->lock);
+                return result;
             }
         }
-        curr = curr->next;
-    }
-
-    if (block == NULL)
-    {
-        return NULL; // No suitable free block found
+        pthread_mutex_unlock(&arena->lock);
     }
+    return 0;
+}
 
-    return allocate_memory(block, nbytes);
+/**
+ * @brief Visit every block of the managed space in address order (one arena at a time)
+ *        The zone of the buddy allocator and the slab of each pool show up as single
+ *        allocated blocks, blocks held in thread caches show up as allocated
+ *        NOTE: the arena being walked is locked, the callback must not allocate or free
+ * @param callback - called with the start, size and allocated flag of each block,
+ *                   returning non zero stops the walk
+ * @param arg - passed through to the callback
+ * @return the value that stopped the walk, 0 if every block was visited
+ */
+int mm_walk(mm_walk_callback callback, void *arg)
+{
+    return mm_heap_walk(&default_heap, callback, arg);
 }
 
-// Memory Deallocation
 /**
- * @brief Requests a block of memory be freed and the storage made available for future allocations
- *        The memory manager must be initialized (mm_init) for this call to succeed
- * @param ptr - a pointer to the start of the space to be freed
- *        Signals a SIGSEGV if a free is not valid
- *            - memory manager is not initialized
- *            - memory manager has been destroyed
- *            - ptr is not allocated (e.g. double free)
+ * @brief Set how many bytes of freed blocks each thread may keep in its own cache of a heap
+ * @param heap - the heap the limit applies to
+ * @param nbytes - the per thread limit, 0 disables the caches (the default)
  */
-void myfree(void *ptr)
+void mm_heap_set_thread_cache_limit(mm_heap_t *heap, int nbytes)
 {
-    if (ptr == NULL)
-    {
-        return; // Invalid pointer
-    }
+    __atomic_store_n(&heap->tcache_limit, nbytes < 0 ? 0 : nbytes, __ATOMIC_RELAXED);
+}
 
-    pthread_mutex_lock(&mutex);
-    Node *curr = memory_list;
-    Node *prev = NULL;
+/**
+ * @brief Set how many bytes of freed blocks each thread may keep in its own cache
+ *        Cached blocks are reused by the same thread without taking the heap lock
+ *        and count as allocated space until they are returned to the heap
+ * @param nbytes - the per thread limit, 0 disables the caches (the default)
+ */
+void mm_set_thread_cache_limit(int nbytes)
+{
+    mm_heap_set_thread_cache_limit(&default_heap, nbytes);
+}
 
-    while (curr != NULL)
+/**
+ * @brief Turn lazy coalescing of a heap on or off (see mm_set_lazy_coalescing)
+ * @param heap - the heap the setting applies to
+ * @param max_blocks - freed blocks each arena may hold back before merging them, 0 turns it off
+ */
+void mm_heap_set_lazy_coalescing(mm_heap_t *heap, int max_blocks)
+{
+    heap->quick_limit = max_blocks < 0 ? 0 : max_blocks;
+    for (int i = 0; i < heap->arena_count; i++)
     {
-        if (curr->start == ptr)
+        Arena *arena = &heap->arenas[i];
+        pthread_mutex_lock(&arena->lock);
+        arena->quick_limit = heap->quick_limit;
+        if (arena->quick_count > arena->quick_limit)
         {
-            if (curr->allocated)
-            {
-                malloc_count++;
-                curr->allocated = 0;
-                allocation_count--;
-
-                // Merge with the previous free block if applicable
-                if (prev != NULL && !(prev->allocated))
-                {
-                    prev->size += curr->size;
-                    prev->next = curr->next;
-                    curr = prev; // Move back to the merged block
-                }
-
-                // Merge with the next free block if applicable
-                if (curr->next != NULL && !(curr->next->allocated))
-                {
-                    curr->size += curr->next->size;
-                    curr->next = curr->next->next;
-                }
-                pthread_mutex_unlock(&mutex);
-
-                return;
-            }
-            else
-            {
-                // Error: Trying to free an unallocated block
-                pthread_mutex_unlock(&mutex);
-                exit(EXIT_FAILURE);
-            }
+            consolidate(arena);
         }
-        prev = curr;
-        curr = curr->next;
+        pthread_mutex_unlock(&arena->lock);
     }
+}
 
-    pthread_mutex_unlock(&mutex);
-    // Error: Pointer not found in memory list
-    printf("Segmentation fault\n\n");
-    exit(EXIT_FAILURE);
+/**
+ * @brief Turn lazy coalescing on or off
+ *        While it is on, freed blocks of up to 512 bytes are not merged with their free
+ *        neighbours right away but kept on per size quick lists, and a request of the same
+ *        size (rounded up to 16 bytes) takes the latest one back without a placement search
+ *        The held back blocks are merged in one pass once an arena holds more than max_blocks
+ *        of them, a placement search fails or mm_consolidate is called
+ *        Held back blocks count as free space and as separate fragments
+ * @param max_blocks - freed blocks each arena may hold back before merging them, 0 turns it off (the default)
+ */
+void mm_set_lazy_coalescing(int max_blocks)
+{
+    mm_heap_set_lazy_coalescing(&default_heap, max_blocks);
 }
 
-// Retrieve the current amount of space allocated by the memory manager
 /**
- * @brief Retrieve the current amount of space allocated by the memory manager (in bytes)
- * @return the current number of allocated bytes
+ * @brief Merge every held back block of a heap (see mm_consolidate)
+ * @param heap - the heap to consolidate
  */
-int get_allocated_space()
+void mm_heap_consolidate(mm_heap_t *heap)
 {
-    int allocated_space = 0;
-    Node *curr = memory_list;
-    while (curr != NULL)
+    for (int i = 0; i < heap->arena_count; i++)
     {
-        if (curr->allocated)
-        {
-            allocated_space += curr->size;
-        }
-        curr = curr->next;
+        pthread_mutex_lock(&heap->arenas[i].lock);
+        consolidate(&heap->arenas[i]);
+        pthread_mutex_unlock(&heap->arenas[i].lock);
     }
-    return allocated_space;
 }
 
-// Retrieve the current amount of available space in the memory manager
 /**
- * @brief Retrieve the current amount of available space in the memory manager (in bytes)
- *        (e.g. sum of all free blocks)
- * @return the current number of free bytes
+ * @brief Merge every block held back by lazy coalescing with its free neighbours now,
+ *        afterwards get_fragment_count and get_remaining_space describe fully merged free space
  */
-int get_remaining_space()
+void mm_consolidate()
 {
-    int free_space = 0;
-    Node *curr = memory_list;
-    while (curr != NULL)
+    mm_heap_consolidate(&default_heap);
+}
+
+/**
+ * @brief Give every idle committed page at the end of a mapped heap back (see mm_trim)
+ * @param heap - the heap to trim
+ * @return the number of bytes given back
+ */
+int mm_heap_trim(mm_heap_t *heap)
+{
+    long long trimmed = 0;
+    for (int i = 0; i < heap->arena_count; i++)
     {
-        if (!curr->allocated)
+        Arena *arena = &heap->arenas[i];
+        pthread_mutex_lock(&arena->lock);
+        consolidate(arena);
+        long long before = arena->trimmed_bytes;
+
+        // The free block with the highest address is the only one that can end the arena
+        Node *tail = arena->addr_root;
+        while (tail != NULL && tail->addr_right != NULL)
+        {
+            tail = tail->addr_right;
+        }
+        if (tail != NULL)
         {
-            free_space += curr->size;
+            trim_tail(arena, tail, 0);
         }
-        curr = curr->next;
+        trimmed += arena->trimmed_bytes - before;
+        pthread_mutex_unlock(&arena->lock);
     }
-    return free_space;
+    return (int)trimmed;
 }
 
-// Retrieve the current number of free blocks
 /**
- * @brief Retrieve the current amount of free blocks (i.e. the count of all the block, not the size)
- * @return the current number of free blocks
+ * @brief Give the pages behind the free space at the end of the heap back to the system now,
+ *        instead of keeping a few chunks committed for the next allocations
+ *        Only heaps set up with mm_init_mapped commit memory, for others this does nothing
+ * @return the number of bytes given back
  */
-int get_fragment_count()
+int mm_trim()
 {
-    int fragment_count = 0;
-    pthread_mutex_lock(&mutex);
-    Node *curr = memory_list;
-    while (curr != NULL)
+    return mm_heap_trim(&default_heap);
+}
+
+/**
+ * @brief Start recording every allocation, reallocation and free to a binary trace file
+ *        The file holds a struct mm_trace_header followed by struct mm_trace_record entries,
+ *        grouped per thread (sort by timestamp for the global order)
+ *        Records are buffered per thread without locking and written by a background thread,
+ *        a record is dropped rather than delaying the caller if its buffer is full
+ *        Pool objects are not recorded, the pool slabs are
+ * @param path - the file to write (truncated)
+ * @return 0 if recording started
+ * @return -1 if a recording is already running or the file cannot be created
+ */
+int mm_trace_start(const char *path)
+{
+    pthread_mutex_lock(&trace_lock);
+    FILE *file = trace_file == NULL ? fopen(path, "wb") : NULL;
+    if (file == NULL)
     {
-        if (!curr->allocated)
-        {
-            fragment_count++;
-        }
-        curr = curr->next;
+        pthread_mutex_unlock(&trace_lock);
+        return -1;
     }
-    pthread_mutex_unlock(&mutex);
-    return fragment_count;
+
+    struct mm_trace_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MM_TRACE_MAGIC, sizeof(header.magic));
+    header.version = MM_TRACE_VERSION;
+    header.record_size = sizeof(struct mm_trace_record);
+    for (int i = 0; i < default_heap.arena_count; i++)
+    {
+        header.managed_size += default_heap.arenas[i].size;
+    }
+    fwrite(&header, sizeof(header), 1, file);
+
+    trace_file = file;
+    trace_dropped = 0;
+    trace_epoch = trace_clock();
+    __atomic_store_n(&trace_active, 1, __ATOMIC_SEQ_CST);
+    if (pthread_create(&trace_flusher, NULL, trace_flush_loop, NULL) != 0)
+    {
+        __atomic_store_n(&trace_active, 0, __ATOMIC_SEQ_CST);
+        fclose(file);
+        trace_file = NULL;
+        pthread_mutex_unlock(&trace_lock);
+        return -1;
+    }
+    pthread_mutex_unlock(&trace_lock);
+    return 0;
 }
 
 /**
- * @brief Retrieve the number of successful malloc calls (for all placement types)
- * @return the total number of successful mallocs
+ * @brief Stop recording, write the remaining records and close the trace file
+ * @return the number of records dropped because a thread's buffer was full
+ * @return -1 if no recording is running
  */
-int get_mymalloc_count()
+long long mm_trace_stop()
 {
-    return malloc_count;
-}
\ No newline at end of file
+    pthread_mutex_lock(&trace_lock);
+    if (trace_file == NULL)
+    {
+        pthread_mutex_unlock(&trace_lock);
+        return -1;
+    }
+    __atomic_store_n(&trace_active, 0, __ATOMIC_SEQ_CST);
+    pthread_join(trace_flusher, NULL);
+
+    // Let records that were being written when recording stopped land
+    for (TraceRing *ring = __atomic_load_n(&trace_rings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next)
+    {
+        while (__atomic_load_n(&ring->busy, __ATOMIC_SEQ_CST))
+        {
+            sched_yield();
+        }
+    }
+    trace_drain();
+    fclose(trace_file);
+    trace_file = NULL;
+    long long dropped = __atomic_load_n(&trace_dropped, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&trace_lock);
+    return dropped;
+}
@@ -11,6 +11,8 @@
 
 #ifndef MEMORY_MANAGER_H
 #define MEMORY_MANAGER_H
+
+#include <stdint.h>
  
 /* Structures */
 /* No "public" structure, the user of the memory manager
@@ -18,14 +20,131 @@
  * allocated and free blocks
  */
 
+/* Fixed size object pool (see mm_pool_create) */
+typedef struct mm_pool mm_pool_t;
+
+/* Relocatable allocation (see mm_handle_alloc) */
+typedef struct mm_handle mm_handle_t;
+
+/* Independently managed region (see mm_create), the functions without a heap
+ * argument operate on the default heap set up by mm_init */
+typedef struct mm_heap mm_heap_t;
+
+/* Arena assignment policies (see mm_init_arenas) */
+#define MM_ARENA_ROUND_ROBIN 0 // Threads are given home arenas in turn
+#define MM_ARENA_BY_CPU      1 // Threads allocate from the arena of their current CPU
+
+/* Page options of mm_init_mapped */
+#define MM_MAP_HUGETLB 1 // Explicit huge pages (MAP_HUGETLB), normal pages if the system has too few
+#define MM_MAP_THP     2 // Ask for transparent huge pages (MADV_HUGEPAGE)
+
+/* Every block handed out by mymalloc_ff, mymalloc_wf and mymalloc_bf starts on this boundary */
+#define MM_DEFAULT_ALIGNMENT 16
+
+/* Trace file format (see mm_trace_start), only the default heap is recorded */
+#define MM_TRACE_MAGIC   "MMTRACE" // Including the terminating NUL
+#define MM_TRACE_VERSION 1
+
+/* Trace record operations */
+#define MM_TRACE_FF      1 // mymalloc_ff
+#define MM_TRACE_NF      2 // mymalloc_nf
+#define MM_TRACE_BF      3 // mymalloc_bf
+#define MM_TRACE_WF      4 // mymalloc_wf
+#define MM_TRACE_ALIGNED 5 // mymalloc_aligned
+#define MM_TRACE_BUDDY   6 // mymalloc_buddy
+#define MM_TRACE_FREE    7 // myfree
+#define MM_TRACE_REALLOC 8 // myrealloc
+#define MM_TRACE_OPS     9 // Size of arrays indexed by operation
+
+/* Start of a trace file */
+struct mm_trace_header
+{
+    char magic[8];         // MM_TRACE_MAGIC
+    uint32_t version;      // MM_TRACE_VERSION
+    uint32_t record_size;  // sizeof(struct mm_trace_record)
+    int64_t managed_size;  // Bytes managed when recording started
+};
+
+/* One call, offsets are relative to the start of the managed space (-1 for none) */
+struct mm_trace_record
+{
+    uint64_t timestamp;    // Nanoseconds since recording started
+    uint32_t thread;       // Recording thread, numbered in order of first record
+    uint16_t op;           // MM_TRACE_* operation
+    uint16_t reserved;
+    int32_t size;          // Requested bytes (0 for frees)
+    int32_t alignment;     // Requested alignment (0 if not applicable)
+    int32_t offset;        // Block returned (-1 if the call failed or returns nothing)
+    int32_t old_offset;    // Block passed in by myfree and myrealloc
+};
+
+/* Free block histogram buckets, bucket i counts sizes from 2^i up to 2^(i+1) - 1
+ * (the last bucket also counts everything larger) */
+#define MM_STATS_BUCKETS 20
+
+/* Heap statistics snapshot (see mm_get_stats) */
+struct mm_stats
+{
+    int allocated_bytes;                  // As get_allocated_space
+    int free_bytes;                       // As get_remaining_space
+    int fragment_count;                   // As get_fragment_count
+    int malloc_count;                     // As get_mymalloc_count
+    long long search_steps;               // As get_search_steps
+    int quick_blocks;                     // Freed blocks held back by lazy coalescing
+    int largest_free;                     // Largest free block
+    double external_fragmentation;        // 1 - largest_free / bytes in free blocks (0 if none are free)
+    int free_histogram[MM_STATS_BUCKETS]; // Free blocks by size
+    long long splits;                     // Blocks split to satisfy a request
+    long long merges;                     // Free blocks merged with a neighbour
+    long long relocations;                // Blocks moved by mm_compact
+    int committed_bytes;                  // Managed bytes backed by pages (all of them unless mapped)
+    long long trimmed_bytes;              // Bytes of idle pages given back by a mapped heap
+    long long calls[MM_TRACE_OPS];        // Public calls by MM_TRACE_* operation
+};
+
+/* Called for each block by mm_walk, returning non zero stops the walk */
+typedef int (*mm_walk_callback)(void* start, int size, int allocated, void* arg);
+
 /* Memory Manager Methods */
 
 /**
  * @brief Initialize the memory manager to "manage" the given location
  * @param start - the start of the memory to manage
  * @param size - the size of the memory to manage
+ * @return 0 if the memory manager was initialized
+ * @return -1 if its bookkeeping could not be allocated
+ */
+int mm_init(void* start, int size);
+
+/**
+ * @brief Initialize the memory manager to "manage" the given location as
+ *        count independent arenas, each with its own lock and free blocks
+ *        Threads allocate from their home arena first and fall back to the
+ *        others, frees are returned to the arena owning the address
+ *        NOTE: a single allocation can never span two arenas
+ * @param start - the start of the memory to manage
+ * @param size - the size of the memory to manage
+ * @param count - the number of arenas to split the memory into
+ * @param assignment - MM_ARENA_ROUND_ROBIN or MM_ARENA_BY_CPU
+ * @return 0 if the memory manager was initialized
+ * @return -1 if its bookkeeping could not be allocated
+ */
+int mm_init_arenas(void* start, int size, int count, int assignment);
+
+/**
+ * @brief Initialize the memory manager over memory it maps itself instead of a caller
+ *        provided buffer: reserve bytes of address space are reserved, but pages are only
+ *        committed (in chunks) as allocations reach them, and idle pages at the end of
+ *        the heap are given back to the system, so starting a large heap is cheap and
+ *        its resident size follows its use
+ *        The space counts as managed from the start (get_remaining_space includes the
+ *        uncommitted part), the mapping is released by mm_destroy
+ * @param reserve - the bytes of address space to reserve (rounded up to whole chunks)
+ * @param flags - MM_MAP_HUGETLB and/or MM_MAP_THP, or 0 for normal pages
+ * @return 0 if the memory was reserved
+ * @return -1 if the system refused the reservation or the bookkeeping could not be allocated
  */
-void mm_init(void* start, int size);
+int mm_init_mapped(int reserve, int flags);
 
 /**
  * @brief Cleans up any storage used by the memory manager
@@ -63,6 +182,135 @@ void* mymalloc_wf(int nbytes);
  */
 void* mymalloc_bf(int nbytes);
 
+/**
+ * @brief Requests a block of memory be allocated using next fit placement algorithm
+ *        The search resumes where the previous next fit search ended and wraps around
+ *        The memory manager must be initialized (mm_init) for this call to succeed
+ * @param nbytes - the number of bytes in the requested memory
+ * @return a pointer to the start of the allocated space
+ */
+void* mymalloc_nf(int nbytes);
+
+/**
+ * @brief Requests a block of memory whose start is a multiple of alignment (first fit placement)
+ *        The memory manager must be initialized (mm_init) for this call to succeed
+ *        Alignments below MM_DEFAULT_ALIGNMENT are raised to it, use 64 for a cache line
+ *        and 4096 for a page
+ *        NOTE: the bytes skipped to reach the boundary stay free
+ * @param nbytes - the number of bytes in the requested memory
+ * @param alignment - the required alignment, a power of two
+ * @return a pointer to the start of the allocated space, or NULL if alignment is not a power of two
+ */
+void* mymalloc_aligned(int nbytes, int alignment);
+
+/**
+ * @brief Reserve part of the managed space for the buddy allocator (mymalloc_buddy)
+ *        The memory manager must be initialized (mm_init) for this call to succeed
+ *        Only one zone can exist, it is released by mm_destroy
+ * @param size - the size of the zone, rounded down to a power of two
+ * @return 0 if the zone was reserved
+ * @return -1 if a zone already exists or there is no free block large enough
+ */
+int mm_buddy_init(int size);
+
+/**
+ * @brief Requests a block of memory be allocated using the binary buddy system
+ *        The block is rounded up to a power of two (at least 16 bytes) and
+ *        taken from the buddy zone, which is reserved on first use from the
+ *        largest free block if mm_buddy_init was not called
+ *        Buddy blocks are returned with myfree
+ *        The memory manager must be initialized (mm_init) for this call to succeed
+ * @param nbytes - the number of bytes in the requested memory
+ * @return a pointer to the start of the allocated space
+ */
+void* mymalloc_buddy(int nbytes);
+
+/**
+ * @brief Create a pool of count objects of obj_size bytes, carved as one
+ *        contiguous slab out of the managed space (first fit)
+ *        Pool objects count towards get_allocated_space and get_mymalloc_count,
+ *        idle objects towards get_remaining_space
+ *        The memory manager must be initialized (mm_init) for this call to succeed
+ * @param obj_size - the size of each object
+ * @param count - the number of objects in the pool
+ * @return the pool, or NULL if there is no free block large enough
+ */
+mm_pool_t* mm_pool_create(int obj_size, int count);
+
+/**
+ * @brief Allocate one object from a pool in constant time
+ * @param pool - the pool to allocate from
+ * @return a pointer to the object, or NULL if the pool is exhausted
+ */
+void* mm_pool_alloc(mm_pool_t* pool);
+
+/**
+ * @brief Return an object to its pool in constant time
+ *        Pool objects must be freed with this call, not myfree
+ *        Signals a SIGSEGV (like myfree) if ptr is not a live object of the pool
+ * @param pool - the pool the object was allocated from
+ * @param ptr - the object to free
+ */
+void mm_pool_free(mm_pool_t* pool, void* ptr);
+
+/**
+ * @brief Destroy a pool and return its slab to the managed space
+ *        All objects of the pool become invalid
+ * @param pool - the pool to destroy
+ */
+void mm_pool_destroy(mm_pool_t* pool);
+
+/**
+ * @brief Requests a relocatable block of memory (first fit placement)
+ *        The block may be moved by mm_compact whenever it is not pinned, so it is only
+ *        reached through mm_pin, and must be freed with mm_handle_free (not myfree)
+ *        Handles are not recorded by mm_trace_start
+ *        The memory manager must be initialized (mm_init) for this call to succeed
+ * @param nbytes - the number of bytes in the requested memory
+ * @return the handle of the block, or NULL if there is no free block large enough
+ */
+mm_handle_t* mm_handle_alloc(int nbytes);
+
+/**
+ * @brief Free a relocatable block and its handle
+ *        Signals a SIGSEGV (like myfree) if the handle was already freed
+ * @param handle - the handle to free
+ */
+void mm_handle_free(mm_handle_t* handle);
+
+/**
+ * @brief Pin a relocatable block so it cannot move and get its current address
+ *        Pins nest, the block may move again once every pin has been undone with mm_unpin
+ * @param handle - the handle of the block
+ * @return the start of the block, valid until the matching mm_unpin
+ */
+void* mm_pin(mm_handle_t* handle);
+
+/**
+ * @brief Undo one mm_pin, the address it returned must no longer be used
+ * @param handle - the handle of the block
+ */
+void mm_unpin(mm_handle_t* handle);
+
+/**
+ * @brief Retrieve the size a relocatable block was requested with
+ * @param handle - the handle of the block
+ * @return the size in bytes
+ */
+int mm_handle_size(mm_handle_t* handle);
+
+/**
+ * @brief Slide relocatable blocks down over the free space in front of them, so the free
+ *        space gathers into one block at the end of each arena (as far as pinned and
+ *        ordinary blocks, which never move, allow)
+ *        The work is done in small steps, each holding an arena lock only briefly, and
+ *        stops once the budget is used up: call again to continue where it stopped
+ *        NOTE: data of unpinned relocatable blocks may move while this runs
+ * @param budget_us - the time budget in microseconds, 0 for no limit
+ * @return 1 if the pass reached the end of the heap, 0 if the budget ran out first
+ */
+int mm_compact(int budget_us);
+
 /**
  * @brief Requests a block of memory be freed and the storage made available for future allocations
  *        The memory manager must be initialized (mm_init) for this call to succeed
@@ -74,6 +322,19 @@ void* mymalloc_bf(int nbytes);
  */
 void myfree(void* ptr);
 
+/**
+ * @brief Change the size of an allocated block, keeping its contents up to the smaller size
+ *        The block is resized in place when possible: shrinking returns the tail to the
+ *        free space and growing absorbs the following free block
+ *        Otherwise a new block is allocated (first fit), the contents copied and the old block freed
+ *        The memory manager must be initialized (mm_init) for this call to succeed
+ * @param ptr - a pointer to the start of the allocated space (NULL to allocate)
+ * @param nbytes - the new size in bytes (0 to free)
+ * @return a pointer to the start of the resized space, or NULL if there is no room (ptr stays valid)
+ *         Signals a SIGSEGV if ptr is not allocated, like myfree
+ */
+void* myrealloc(void* ptr, int nbytes);
+
 /**
  * @brief Retrieve the current amount of space allocated by the memory manager (in bytes)
  * @return the current number of allocated bytes
@@ -99,4 +360,276 @@ int get_fragment_count();
  */
 int get_mymalloc_count();
 
+/**
+ * @brief Retrieve the number of free blocks examined by placement searches since mm_init
+ *        Dividing by get_mymalloc_count gives the average search length of a strategy
+ * @return the number of free index nodes visited
+ */
+long long get_search_steps();
+
+/**
+ * @brief Take a snapshot of the heap statistics
+ *        Every value is kept up to date as blocks are allocated and freed, so this
+ *        takes no lock and never walks the blocks
+ *        NOTE: values are read one by one, a snapshot taken while other threads
+ *              allocate may be slightly inconsistent
+ * @param stats - filled in with the current statistics
+ */
+void mm_get_stats(struct mm_stats* stats);
+
+/**
+ * @brief Visit every block of the managed space in address order (one arena at a time)
+ *        The zone of the buddy allocator and the slab of each pool show up as single
+ *        allocated blocks, blocks held in thread caches show up as allocated
+ *        NOTE: the arena being walked is locked, the callback must not allocate or free
+ * @param callback - called with the start, size and allocated flag of each block,
+ *                   returning non zero stops the walk
+ * @param arg - passed through to the callback
+ * @return the value that stopped the walk, 0 if every block was visited
+ */
+int mm_walk(mm_walk_callback callback, void* arg);
+
+/**
+ * @brief Set how many bytes of freed blocks each thread may keep in its own cache
+ *        Cached blocks are reused by the same thread without taking the heap lock
+ *        and count as allocated space until they are returned to the heap
+ * @param nbytes - the per thread limit, 0 disables the caches (the default)
+ */
+void mm_set_thread_cache_limit(int nbytes);
+
+/**
+ * @brief Turn lazy coalescing on or off
+ *        While it is on, freed blocks of up to 512 bytes are not merged with their free
+ *        neighbours right away but kept on per size quick lists, and a request of the same
+ *        size (rounded up to 16 bytes) takes the latest one back without a placement search
+ *        The held back blocks are merged in one pass once an arena holds more than max_blocks
+ *        of them, a placement search fails or mm_consolidate is called
+ *        Held back blocks count as free space and as separate fragments
+ * @param max_blocks - freed blocks each arena may hold back before merging them, 0 turns it off (the default)
+ */
+void mm_set_lazy_coalescing(int max_blocks);
+
+/**
+ * @brief Merge every block held back by lazy coalescing with its free neighbours now,
+ *        afterwards get_fragment_count and get_remaining_space describe fully merged free space
+ */
+void mm_consolidate();
+
+/**
+ * @brief Give the pages behind the free space at the end of the heap back to the system now,
+ *        instead of keeping a few chunks committed for the next allocations
+ *        Only heaps set up with mm_init_mapped commit memory, for others this does nothing
+ * @return the number of bytes given back
+ */
+int mm_trim();
+
+/**
+ * @brief Start recording every allocation, reallocation and free to a binary trace file
+ *        The file holds a struct mm_trace_header followed by struct mm_trace_record entries,
+ *        grouped per thread (sort by timestamp for the global order)
+ *        Records are buffered per thread without locking and written by a background thread,
+ *        a record is dropped rather than delaying the caller if its buffer is full
+ *        Pool objects are not recorded, the pool slabs are
+ * @param path - the file to write (truncated)
+ * @return 0 if recording started
+ * @return -1 if a recording is already running or the file cannot be created
+ */
+int mm_trace_start(const char* path);
+
+/**
+ * @brief Stop recording, write the remaining records and close the trace file
+ * @return the number of records dropped because a thread's buffer was full
+ * @return -1 if no recording is running
+ */
+long long mm_trace_stop();
+
+/* Heap Methods
+ * Blocks must be freed or resized through the heap they were allocated from
+ */
+
+/**
+ * @brief Create a heap that manages the given location independently of the default heap
+ *        and of every other heap (its own arenas, locks, buddy zone, pools and statistics)
+ *        NOTE: Do NOT malloc space for the memory to manage
+ *              The invoker of this function will provide the memory
+ * @param start - the start of the memory to manage
+ * @param size - the size of the memory to manage
+ * @return the heap, or NULL if it cannot be created
+ */
+mm_heap_t* mm_create(void* start, int size);
+
+/**
+ * @brief Create a heap that manages the given location as count independent arenas
+ *        (see mm_create and mm_init_arenas)
+ * @param start - the start of the memory to manage
+ * @param size - the size of the memory to manage
+ * @param count - the number of arenas to split the memory into
+ * @param assignment - MM_ARENA_ROUND_ROBIN or MM_ARENA_BY_CPU
+ * @return the heap, or NULL if it cannot be created
+ */
+mm_heap_t* mm_create_arenas(void* start, int size, int count, int assignment);
+
+/**
+ * @brief Destroy a heap created by mm_create, all its allocated spaces and pools become invalid
+ *        NOTE: no other thread may be using the heap
+ * @param heap - the heap to destroy
+ */
+void mm_heap_destroy(mm_heap_t* heap);
+
+/**
+ * @brief Create a heap over memory it maps itself (see mm_init_mapped)
+ * @param reserve - the bytes of address space to reserve
+ * @param flags - MM_MAP_HUGETLB and/or MM_MAP_THP, or 0 for normal pages
+ * @return the heap, or NULL if it cannot be created
+ */
+mm_heap_t* mm_create_mapped(int reserve, int flags);
+
+/**
+ * @brief Requests a block of memory from a heap using first fit placement algorithm
+ * @param heap - the heap to allocate from
+ * @param nbytes - the number of bytes in the requested memory
+ * @return a pointer to the start of the allocated space
+ */
+void* mm_heap_alloc_ff(mm_heap_t* heap, int nbytes);
+
+/**
+ * @brief Requests a block of memory from a heap using worst fit placement algorithm
+ * @param heap - the heap to allocate from
+ * @param nbytes - the number of bytes in the requested memory
+ * @return a pointer to the start of the allocated space
+ */
+void* mm_heap_alloc_wf(mm_heap_t* heap, int nbytes);
+
+/**
+ * @brief Requests a block of memory from a heap using best fit placement algorithm
+ * @param heap - the heap to allocate from
+ * @param nbytes - the number of bytes in the requested memory
+ * @return a pointer to the start of the allocated space
+ */
+void* mm_heap_alloc_bf(mm_heap_t* heap, int nbytes);
+
+/**
+ * @brief Requests a block of memory from a heap using next fit placement algorithm
+ *        Every arena of the heap keeps its own position
+ * @param heap - the heap to allocate from
+ * @param nbytes - the number of bytes in the requested memory
+ * @return a pointer to the start of the allocated space
+ */
+void* mm_heap_alloc_nf(mm_heap_t* heap, int nbytes);
+
+/**
+ * @brief Requests a block of memory from a heap whose start is a multiple of alignment
+ *        (see mymalloc_aligned)
+ * @param heap - the heap to allocate from
+ * @param nbytes - the number of bytes in the requested memory
+ * @param alignment - the required alignment, a power of two
+ * @return a pointer to the start of the allocated space, or NULL if alignment is not a power of two
+ */
+void* mm_heap_alloc_aligned(mm_heap_t* heap, int nbytes, int alignment);
+
+/**
+ * @brief Reserve part of a heap for its buddy allocator (see mm_buddy_init)
+ * @param heap - the heap to reserve the zone in
+ * @param size - the size of the zone, rounded down to a power of two
+ * @return 0 if the zone was reserved
+ * @return -1 if a zone already exists or there is no free block large enough
+ */
+int mm_heap_buddy_init(mm_heap_t* heap, int size);
+
+/**
+ * @brief Requests a block of memory from the buddy zone of a heap (see mymalloc_buddy)
+ * @param heap - the heap to allocate from
+ * @param nbytes - the number of bytes in the requested memory
+ * @return a pointer to the start of the allocated space
+ */
+void* mm_heap_alloc_buddy(mm_heap_t* heap, int nbytes);
+
+/**
+ * @brief Create a pool of count objects of obj_size bytes, carved as one
+ *        contiguous slab out of a heap (first fit)
+ *        The pool functions find the heap through the pool
+ * @param heap - the heap to carve the slab out of
+ * @param obj_size - the size of each object
+ * @param count - the number of objects in the pool
+ * @return the pool, or NULL if there is no free block large enough
+ */
+mm_pool_t* mm_heap_pool_create(mm_heap_t* heap, int obj_size, int count);
+
+/**
+ * @brief Requests a relocatable block of memory from a heap (see mm_handle_alloc)
+ * @param heap - the heap to allocate from
+ * @param nbytes - the number of bytes in the requested memory
+ * @return the handle of the block, or NULL if there is no free block large enough
+ */
+mm_handle_t* mm_heap_handle_alloc(mm_heap_t* heap, int nbytes);
+
+/**
+ * @brief Compact a heap for at most budget_us microseconds (see mm_compact)
+ * @param heap - the heap to compact
+ * @param budget_us - the time budget in microseconds, 0 for no limit
+ * @return 1 if the pass reached the end of the heap, 0 if the budget ran out first
+ */
+int mm_heap_compact(mm_heap_t* heap, int budget_us);
+
+/**
+ * @brief Requests a block of memory be returned to the heap it was allocated from
+ *        Signals a SIGSEGV if ptr is not an allocated block of the heap (see myfree)
+ * @param heap - the heap the block was allocated from
+ * @param ptr - a pointer to the start of the space to be freed
+ */
+void mm_heap_free(mm_heap_t* heap, void* ptr);
+
+/**
+ * @brief Change the size of a block allocated from a heap (see myrealloc)
+ * @param heap - the heap the block was allocated from
+ * @param ptr - a pointer to the start of the allocated space (NULL to allocate)
+ * @param nbytes - the new size in bytes (0 to free)
+ * @return a pointer to the start of the resized space, or NULL if there is no room (ptr stays valid)
+ */
+void* mm_heap_realloc(mm_heap_t* heap, void* ptr, int nbytes);
+
+/**
+ * @brief Take a snapshot of the statistics of a heap (see mm_get_stats)
+ * @param heap - the heap to describe
+ * @param stats - filled in with the current statistics
+ */
+void mm_heap_get_stats(mm_heap_t* heap, struct mm_stats* stats);
+
+/**
+ * @brief Visit every block of a heap in address order (see mm_walk)
+ * @param heap - the heap to walk
+ * @param callback - called with the start, size and allocated flag of each block,
+ *                   returning non zero stops the walk
+ * @param arg - passed through to the callback
+ * @return the value that stopped the walk, 0 if every block was visited
+ */
+int mm_heap_walk(mm_heap_t* heap, mm_walk_callback callback, void* arg);
+
+/**
+ * @brief Turn lazy coalescing of a heap on or off (see mm_set_lazy_coalescing)
+ * @param heap - the heap the setting applies to
+ * @param max_blocks - freed blocks each arena may hold back before merging them, 0 turns it off
+ */
+void mm_heap_set_lazy_coalescing(mm_heap_t* heap, int max_blocks);
+
+/**
+ * @brief Merge every held back block of a heap (see mm_consolidate)
+ * @param heap - the heap to consolidate
+ */
+void mm_heap_consolidate(mm_heap_t* heap);
+
+/**
+ * @brief Give every idle committed page at the end of a mapped heap back (see mm_trim)
+ * @param heap - the heap to trim
+ * @return the number of bytes given back
+ */
+int mm_heap_trim(mm_heap_t* heap);
+
+/**
+ * @brief Set how many bytes of freed blocks each thread may keep in its own cache of a heap
+ * @param heap - the heap the limit applies to
+ * @param nbytes - the per thread limit, 0 disables the caches (the default)
+ */
+void mm_heap_set_thread_cache_limit(mm_heap_t* heap, int nbytes);
+
 #endif
@@ -0,0 +1,721 @@
+/**
+ * @file mmbench.c
+ *
+ * @brief Allocator benchmark - replays allocation traces against the
+ *        placement algorithms and reports throughput, per call latency
+ *        percentiles, peak fragment count and utilisation for a sweep of
+ *        thread counts
+ *
+ * Traces are either generated from a synthetic size distribution or read
+ * from a text file with one operation per line:
+ *     a <id> <size>   allocate size bytes and remember the block as id
+ *     r <id> <size>   resize the block remembered as id (myrealloc)
+ *     f <id>          free the block remembered as id
+ * Blank lines and lines starting with # are ignored.  A binary recording
+ * made with mm_trace_start is accepted as well: its records are put in
+ * timestamp order and every allocation, whatever placement it used, is
+ * replayed with the placement under test.  Every thread replays the
+ * whole trace with its own set of ids.
+ *
+ * Utilisation is the peak live payload divided by the heap footprint at that
+ * moment (the highest byte ever allocated), so it is only meaningful when the
+ * heap is a single arena (the default).
+ */
+
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "memory_manager.h"
+
+#define DEFAULT_OPS 200000
+#define DEFAULT_LIVE 1024
+#define DEFAULT_HEAP (64 << 20)
+#define SAMPLE_EVERY 64 // Operations between fragmentation samples
+#define MAX_THREADS 64
+
+typedef void *(*malloc_function)(int nbytes);
+
+typedef struct
+{
+    const char *name;
+    malloc_function allocate;
+} Strategy;
+
+static Strategy strategies[] = {
+    {"ff", mymalloc_ff},
+    {"nf", mymalloc_nf},
+    {"bf", mymalloc_bf},
+    {"wf", mymalloc_wf},
+};
+
+// One trace operation
+typedef struct
+{
+    char type; // 'a' to allocate, 'r' to resize, 'f' to free
+    int id;    // Block the operation refers to
+    int size;  // Bytes to allocate
+} TraceOp;
+
+typedef struct
+{
+    TraceOp *ops;
+    int count;
+    int max_id; // Largest id used by the trace
+} Trace;
+
+// Per thread results (padded so threads do not share cache lines)
+typedef struct
+{
+    pthread_t thread;
+    Strategy *strategy;
+    unsigned int *latencies; // Nanoseconds per allocate/free call
+    int calls;
+    int failures;
+    long long live_bytes; // Payload currently held by the thread
+    long long high_water; // Highest heap offset the thread was handed
+    char pad[64];
+} Worker;
+
+static Trace trace;
+static char *heap;
+static Worker workers[MAX_THREADS];
+static int worker_count;
+static pthread_barrier_t start_barrier;
+
+// Shared peaks, updated by whichever thread takes a sample
+static pthread_mutex_t peak_lock = PTHREAD_MUTEX_INITIALIZER;
+static int peak_fragments;
+static long long peak_payload;
+static long long peak_footprint;
+
+/**
+ * @brief Append an operation to the trace, growing it as needed
+ * @param type - 'a', 'r' or 'f'
+ * @param id - the block id
+ * @param size - the allocation size (ignored for frees)
+ */
+static void trace_add(char type, int id, int size)
+{
+    static int capacity = 0;
+    if (trace.count == capacity)
+    {
+        capacity = capacity == 0 ? 1024 : capacity * 2;
+        trace.ops = (TraceOp *)realloc(trace.ops, capacity * sizeof(TraceOp));
+        if (trace.ops == NULL)
+        {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    trace.ops[trace.count++] = (TraceOp){type, id, size};
+    if (id > trace.max_id)
+    {
+        trace.max_id = id;
+    }
+}
+
+/**
+ * @brief Draw a request size from one of the synthetic distributions
+ * @param distribution - "small", "uniform" or "mixed"
+ * @param seed - the generator state
+ * @return the size in bytes
+ */
+static int synthetic_size(const char *distribution, unsigned int *seed)
+{
+    if (strcmp(distribution, "small") == 0)
+    {
+        return 8 + rand_r(seed) % 120;
+    }
+    if (strcmp(distribution, "uniform") == 0)
+    {
+        return 16 + rand_r(seed) % 2033;
+    }
+    // mixed: mostly small objects with the occasional large buffer
+    if (rand_r(seed) % 10 == 0)
+    {
+        return 512 + rand_r(seed) % 8192;
+    }
+    return 8 + rand_r(seed) % 248;
+}
+
+/**
+ * @brief Generate a random trace that keeps about live blocks allocated
+ * @param distribution - the size distribution
+ * @param ops - the number of operations
+ * @param live - the number of blocks held at steady state
+ */
+static void trace_generate(const char *distribution, int ops, int live)
+{
+    unsigned int seed = 12345;
+    int *held = (int *)malloc(live * sizeof(int));    // Ids currently allocated
+    int *unused = (int *)malloc(live * sizeof(int));  // Ids free for reuse
+    int held_count = 0;
+    int unused_count = live;
+    for (int id = 0; id < live; id++)
+    {
+        unused[id] = live - 1 - id;
+    }
+
+    for (int i = 0; i < ops; i++)
+    {
+        // Ramp up to half the live set, then free and allocate in roughly equal measure
+        if (unused_count == 0 || (held_count > live / 2 && rand_r(&seed) % 2 == 0))
+        {
+            int k = rand_r(&seed) % held_count;
+            trace_add('f', held[k], 0);
+            unused[unused_count++] = held[k];
+            held[k] = held[--held_count];
+        }
+        else
+        {
+            int id = unused[--unused_count];
+            held[held_count++] = id;
+            trace_add('a', id, synthetic_size(distribution, &seed));
+        }
+    }
+    free(held);
+    free(unused);
+}
+
+/*
+ * Recorded offsets are turned into trace ids with a small open addressing
+ * map, ids of freed blocks are reused so the id table stays as small as the
+ * recording's live set.
+ */
+typedef struct
+{
+    int32_t *offsets; // Key of each slot (-1 if empty)
+    int *ids;         // Id of the block at that offset
+    int capacity;     // Power of two
+    int *unused;      // Ids free for reuse
+    int unused_count;
+    int next_id;
+} OffsetMap;
+
+static unsigned int offset_slot(OffsetMap *map, int32_t offset)
+{
+    return ((uint32_t)offset * 2654435761u) & (map->capacity - 1);
+}
+
+// Slot holding offset, or the empty slot where it belongs
+static unsigned int offset_find(OffsetMap *map, int32_t offset)
+{
+    unsigned int slot = offset_slot(map, offset);
+    while (map->offsets[slot] != -1 && map->offsets[slot] != offset)
+    {
+        slot = (slot + 1) & (map->capacity - 1);
+    }
+    return slot;
+}
+
+// Remove the block at offset and return its id (-1 if it was allocated before the recording)
+static int offset_take(OffsetMap *map, int32_t offset)
+{
+    unsigned int slot = offset_find(map, offset);
+    if (map->offsets[slot] == -1)
+    {
+        return -1;
+    }
+    int id = map->ids[slot];
+    map->offsets[slot] = -1;
+
+    // Shift back the entries that probed past the emptied slot
+    unsigned int next = (slot + 1) & (map->capacity - 1);
+    while (map->offsets[next] != -1)
+    {
+        unsigned int home = offset_slot(map, map->offsets[next]);
+        if (((next - home) & (map->capacity - 1)) >= ((next - slot) & (map->capacity - 1)))
+        {
+            map->offsets[slot] = map->offsets[next];
+            map->ids[slot] = map->ids[next];
+            map->offsets[next] = -1;
+            slot = next;
+        }
+        next = (next + 1) & (map->capacity - 1);
+    }
+    return id;
+}
+
+static void offset_put(OffsetMap *map, int32_t offset, int id)
+{
+    unsigned int slot = offset_find(map, offset);
+    map->offsets[slot] = offset;
+    map->ids[slot] = id;
+}
+
+// Free the id still mapped at a newly returned offset (timestamps of two threads raced)
+static void offset_retire(OffsetMap *map, int32_t offset)
+{
+    int stale = offset_take(map, offset);
+    if (stale >= 0)
+    {
+        trace_add('f', stale, 0);
+        map->unused[map->unused_count++] = stale;
+    }
+}
+
+// Map a newly allocated offset to a fresh id
+static int offset_new(OffsetMap *map, int32_t offset)
+{
+    offset_retire(map, offset);
+    int id = map->unused_count > 0 ? map->unused[--map->unused_count] : map->next_id++;
+    offset_put(map, offset, id);
+    return id;
+}
+
+static int compare_record(const void *a, const void *b)
+{
+    const struct mm_trace_record *x = (const struct mm_trace_record *)a;
+    const struct mm_trace_record *y = (const struct mm_trace_record *)b;
+    if (x->timestamp != y->timestamp)
+    {
+        return x->timestamp < y->timestamp ? -1 : 1;
+    }
+    return x->thread < y->thread ? -1 : x->thread > y->thread;
+}
+
+/**
+ * @brief Load a binary trace recorded with mm_trace_start
+ * @param path - the trace file
+ * @param file - the file, positioned after the header
+ * @param header - the header already read
+ */
+static void trace_load_recording(const char *path, FILE *file, struct mm_trace_header *header)
+{
+    if (header->version != MM_TRACE_VERSION || header->record_size != sizeof(struct mm_trace_record))
+    {
+        fprintf(stderr, "%s: unsupported trace version\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    // Records are grouped per thread in the file
+    int capacity = 1024;
+    int count = 0;
+    struct mm_trace_record *records = (struct mm_trace_record *)malloc(capacity * sizeof(*records));
+    while (records != NULL && fread(&records[count], sizeof(*records), 1, file) == 1)
+    {
+        if (++count == capacity)
+        {
+            capacity *= 2;
+            records = (struct mm_trace_record *)realloc(records, capacity * sizeof(*records));
+        }
+    }
+    if (records == NULL)
+    {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+    }
+    qsort(records, count, sizeof(*records), compare_record);
+
+    OffsetMap map;
+    map.capacity = 1024;
+    while (map.capacity < 2 * count)
+    {
+        map.capacity *= 2;
+    }
+    map.offsets = (int32_t *)malloc(map.capacity * sizeof(int32_t));
+    map.ids = (int *)malloc(map.capacity * sizeof(int));
+    map.unused = (int *)malloc((count + 1) * sizeof(int));
+    memset(map.offsets, -1, map.capacity * sizeof(int32_t));
+    map.unused_count = 0;
+    map.next_id = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        struct mm_trace_record *record = &records[i];
+        int id;
+        switch (record->op)
+        {
+        case MM_TRACE_FREE:
+            id = offset_take(&map, record->old_offset);
+            if (id >= 0)
+            {
+                trace_add('f', id, 0);
+                map.unused[map.unused_count++] = id;
+            }
+            break;
+        case MM_TRACE_REALLOC:
+            if (record->offset < 0)
+            {
+                break; // Failed, the block stayed where it was
+            }
+            id = offset_take(&map, record->old_offset);
+            if (id < 0)
+            {
+                trace_add('a', offset_new(&map, record->offset), record->size);
+                break;
+            }
+            offset_retire(&map, record->offset);
+            offset_put(&map, record->offset, id);
+            trace_add('r', id, record->size);
+            break;
+        default:
+            if (record->offset >= 0)
+            {
+                trace_add('a', offset_new(&map, record->offset), record->size);
+            }
+            break;
+        }
+    }
+    free(map.offsets);
+    free(map.ids);
+    free(map.unused);
+    free(records);
+}
+
+/**
+ * @brief Load a trace file, either text or a binary recording
+ * @param path - the trace file
+ */
+static void trace_load(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    struct mm_trace_header header;
+    if (fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, MM_TRACE_MAGIC, sizeof(header.magic)) == 0)
+    {
+        trace_load_recording(path, file, &header);
+        fclose(file);
+        return;
+    }
+    rewind(file);
+
+    char line[128];
+    int line_number = 0;
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        line_number++;
+        char type;
+        int id;
+        int size = 0;
+        if (line[0] == '#' || line[0] == '\n')
+        {
+            continue;
+        }
+        if (sscanf(line, " %c %d %d", &type, &id, &size) < 2 || (type != 'a' && type != 'r' && type != 'f') ||
+            id < 0 || size < 0)
+        {
+            fprintf(stderr, "%s:%d: bad trace line\n", path, line_number);
+            exit(EXIT_FAILURE);
+        }
+        trace_add(type, id, size);
+    }
+    fclose(file);
+}
+
+static long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * @brief Record the current fragment count and utilisation if they are new peaks
+ */
+static void sample()
+{
+    int fragments = get_fragment_count();
+    long long payload = 0;
+    long long footprint = 0;
+    for (int i = 0; i < worker_count; i++)
+    {
+        payload += __atomic_load_n(&workers[i].live_bytes, __ATOMIC_RELAXED);
+        long long high_water = __atomic_load_n(&workers[i].high_water, __ATOMIC_RELAXED);
+        footprint = high_water > footprint ? high_water : footprint;
+    }
+
+    pthread_mutex_lock(&peak_lock);
+    if (fragments > peak_fragments)
+    {
+        peak_fragments = fragments;
+    }
+    if (payload > peak_payload)
+    {
+        peak_payload = payload;
+        peak_footprint = footprint;
+    }
+    pthread_mutex_unlock(&peak_lock);
+}
+
+/**
+ * @brief Replay the whole trace with the worker's placement algorithm
+ * @param args - the Worker
+ * @return NULL
+ */
+static void *replay(void *args)
+{
+    Worker *worker = (Worker *)args;
+    void **blocks = (void **)calloc(trace.max_id + 1, sizeof(void *));
+    int *sizes = (int *)calloc(trace.max_id + 1, sizeof(int));
+
+    pthread_barrier_wait(&start_barrier);
+    for (int i = 0; i < trace.count; i++)
+    {
+        TraceOp *op = &trace.ops[i];
+        void *old = blocks[op->id];
+        void *ptr = NULL;
+        if (op->type != 'a' && old == NULL)
+        {
+            continue; // The allocation failed earlier
+        }
+        if (op->type == 'a' && old != NULL)
+        {
+            myfree(old); // Trace reuses a live id, drop the old block
+            __atomic_store_n(&worker->live_bytes, worker->live_bytes - sizes[op->id], __ATOMIC_RELAXED);
+            old = NULL;
+        }
+
+        long long start = now_ns();
+        if (op->type == 'f')
+        {
+            myfree(old);
+        }
+        else if (op->type == 'r')
+        {
+            ptr = myrealloc(old, op->size);
+        }
+        else
+        {
+            ptr = worker->strategy->allocate(op->size);
+        }
+        worker->latencies[worker->calls++] = (unsigned int)(now_ns() - start);
+
+        if (op->type == 'f')
+        {
+            blocks[op->id] = NULL;
+            __atomic_store_n(&worker->live_bytes, worker->live_bytes - sizes[op->id], __ATOMIC_RELAXED);
+        }
+        else if (ptr == NULL)
+        {
+            worker->failures++; // A failed resize keeps the old block
+        }
+        else
+        {
+            memset(ptr, 0xA5, op->size < 64 ? op->size : 64); // Touch the block
+            long long delta = op->size - (old != NULL ? sizes[op->id] : 0);
+            __atomic_store_n(&worker->live_bytes, worker->live_bytes + delta, __ATOMIC_RELAXED);
+            blocks[op->id] = ptr;
+            sizes[op->id] = op->size;
+            long long end = (char *)ptr + op->size - heap;
+            if (end > worker->high_water)
+            {
+                __atomic_store_n(&worker->high_water, end, __ATOMIC_RELAXED);
+            }
+        }
+        if (i % SAMPLE_EVERY == 0)
+        {
+            sample();
+        }
+    }
+
+    // Leave the heap empty for the next run
+    for (int id = 0; id <= trace.max_id; id++)
+    {
+        if (blocks[id] != NULL)
+        {
+            myfree(blocks[id]);
+        }
+    }
+    free(blocks);
+    free(sizes);
+    return NULL;
+}
+
+static int compare_latency(const void *a, const void *b)
+{
+    unsigned int x = *(const unsigned int *)a;
+    unsigned int y = *(const unsigned int *)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * @brief Run the trace on threads threads with one placement algorithm and print a result row
+ * @param strategy - the placement algorithm
+ * @param threads - the number of threads replaying the trace
+ * @param heap_size - the size of the managed space
+ * @param arena_count - arenas to split the heap into
+ * @param cache_limit - thread cache limit in bytes
+ * @param quick_limit - blocks held back per arena by lazy coalescing (0 merges eagerly)
+ */
+static void run(Strategy *strategy, int threads, int heap_size, int arena_count, int cache_limit, int quick_limit)
+{
+    heap = (char *)malloc(heap_size);
+    if (heap == NULL)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    mm_init_arenas(heap, heap_size, arena_count, MM_ARENA_ROUND_ROBIN);
+    mm_set_thread_cache_limit(cache_limit);
+    mm_set_lazy_coalescing(quick_limit);
+    peak_fragments = 0;
+    peak_payload = 0;
+    peak_footprint = 0;
+
+    worker_count = threads;
+    pthread_barrier_init(&start_barrier, NULL, threads + 1);
+    for (int i = 0; i < threads; i++)
+    {
+        workers[i].strategy = strategy;
+        workers[i].latencies = (unsigned int *)malloc(trace.count * sizeof(unsigned int));
+        workers[i].calls = 0;
+        workers[i].failures = 0;
+        workers[i].live_bytes = 0;
+        workers[i].high_water = 0;
+        pthread_create(&workers[i].thread, NULL, replay, &workers[i]);
+    }
+    pthread_barrier_wait(&start_barrier);
+    long long start = now_ns();
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+    }
+    double seconds = (now_ns() - start) / 1e9;
+    pthread_barrier_destroy(&start_barrier);
+
+    // Merge the latencies of every thread
+    long long calls = 0;
+    int failures = 0;
+    for (int i = 0; i < threads; i++)
+    {
+        calls += workers[i].calls;
+        failures += workers[i].failures;
+    }
+    unsigned int *latencies = (unsigned int *)malloc((calls > 0 ? calls : 1) * sizeof(unsigned int));
+    long long merged = 0;
+    for (int i = 0; i < threads; i++)
+    {
+        memcpy(latencies + merged, workers[i].latencies, workers[i].calls * sizeof(unsigned int));
+        merged += workers[i].calls;
+        free(workers[i].latencies);
+    }
+    qsort(latencies, calls, sizeof(unsigned int), compare_latency);
+    unsigned int p50 = calls > 0 ? latencies[calls * 50 / 100] : 0;
+    unsigned int p99 = calls > 0 ? latencies[calls * 99 / 100] : 0;
+    unsigned int p999 = calls > 0 ? latencies[calls * 999 / 1000] : 0;
+    free(latencies);
+
+    printf("%-4s %7d %12.0f %8u %8u %8u %10d %7.1f%% %9d\n", strategy->name, threads, calls / seconds, p50, p99,
+           p999, peak_fragments, peak_footprint > 0 ? 100.0 * peak_payload / peak_footprint : 0.0, failures);
+    mm_destroy();
+    free(heap);
+}
+
+static void usage(const char *program)
+{
+    fprintf(stderr,
+            "usage: %s [-s ff,nf,bf,wf] [-t 1,2,4] [-d small|uniform|mixed] [-n ops] [-l live]\n"
+            "          [-r trace_file] [-H heap_bytes] [-a arenas] [-c cache_bytes] [-q quick_blocks]\n",
+            program);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Program entry procedure - builds the trace and runs every strategy/thread count pair
+ * @param argc - the number of arguments
+ * @param argv - the options (see usage)
+ * @return 0
+ */
+int main(int argc, char *argv[])
+{
+    const char *strategy_list = "ff,nf,bf,wf";
+    char thread_list[64] = "1,2,4";
+    const char *distribution = "mixed";
+    const char *trace_file = NULL;
+    int ops = DEFAULT_OPS;
+    int live = DEFAULT_LIVE;
+    int heap_size = DEFAULT_HEAP;
+    int arena_count = 1;
+    int cache_limit = 0;
+    int quick_limit = 0;
+
+    int option;
+    while ((option = getopt(argc, argv, "s:t:d:n:l:r:H:a:c:q:")) != -1)
+    {
+        switch (option)
+        {
+        case 's':
+            strategy_list = optarg;
+            break;
+        case 't':
+            snprintf(thread_list, sizeof(thread_list), "%s", optarg);
+            break;
+        case 'd':
+            distribution = optarg;
+            break;
+        case 'n':
+            ops = atoi(optarg);
+            break;
+        case 'l':
+            live = atoi(optarg);
+            break;
+        case 'r':
+            trace_file = optarg;
+            break;
+        case 'H':
+            heap_size = atoi(optarg);
+            break;
+        case 'a':
+            arena_count = atoi(optarg);
+            break;
+        case 'c':
+            cache_limit = atoi(optarg);
+            break;
+        case 'q':
+            quick_limit = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (ops <= 0 || live <= 0 || heap_size <= 0 || arena_count <= 0)
+    {
+        usage(argv[0]);
+    }
+
+    if (trace_file != NULL)
+    {
+        trace_load(trace_file);
+        printf("trace %s: %d operations\n", trace_file, trace.count);
+    }
+    else
+    {
+        trace_generate(distribution, ops, live);
+        printf("%s distribution: %d operations, %d live blocks\n", distribution, trace.count, live);
+    }
+    printf("heap %d bytes in %d arena(s), thread cache %d bytes, lazy coalescing %d blocks, latencies in ns\n",
+           heap_size, arena_count, cache_limit, quick_limit);
+    printf("%-4s %7s %12s %8s %8s %8s %10s %8s %9s\n", "fit", "threads", "ops/sec", "p50", "p99", "p99.9",
+           "peak frags", "util", "failures");
+
+    for (int s = 0; s < (int)(sizeof(strategies) / sizeof(strategies[0])); s++)
+    {
+        if (strstr(strategy_list, strategies[s].name) == NULL)
+        {
+            continue;
+        }
+        char threads_copy[64];
+        snprintf(threads_copy, sizeof(threads_copy), "%s", thread_list);
+        char *saved;
+        for (char *token = strtok_r(threads_copy, ",", &saved); token != NULL; token = strtok_r(NULL, ",", &saved))
+        {
+            int threads = atoi(token);
+            if (threads < 1 || threads > MAX_THREADS)
+            {
+                usage(argv[0]);
+            }
+            run(&strategies[s], threads, heap_size, arena_count, cache_limit, quick_limit);
+        }
+    }
+    free(trace.ops);
+    return 0;
+}
@@ -0,0 +1,292 @@
+/**
+ * @file mmcheck.c
+ *
+ * @brief Regression checks for the memory manager extensions that the
+ *        sample testers do not exercise.  Prints one line per check and
+ *        exits with 1 if any of them failed (make check)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "memory_manager.h"
+
+#define HEAP_SIZE (1 << 20)
+#define ROUNDS 1000
+
+static int failures = 0;
+
+static void check(int passed, const char *name, const char *detail)
+{
+    printf("%s: %s%s%s\n", passed ? "PASS" : "FAIL", name, passed ? "" : " - ", passed ? "" : detail);
+    if (!passed)
+    {
+        failures++;
+    }
+}
+
+/**
+ * @brief Two sizes in different size classes (64 and 1024 bytes), allocated
+ *        and freed alternately, must both be served from the thread cache
+ */
+static void check_thread_cache_size_classes(char *memory)
+{
+    mm_init(memory, HEAP_SIZE);
+    mm_set_thread_cache_limit(64 << 10);
+
+    // Warm both bins
+    myfree(mymalloc_ff(64));
+    myfree(mymalloc_ff(1024));
+
+    long long steps = get_search_steps();
+    for (int i = 0; i < ROUNDS; i++)
+    {
+        void *small = mymalloc_ff(64);
+        void *large = mymalloc_ff(1024);
+        myfree(small);
+        myfree(large);
+    }
+    steps = get_search_steps() - steps;
+
+    // A miss searches the free blocks at least once, hits do not search at all
+    char detail[64];
+    snprintf(detail, sizeof(detail), "%lld search steps for %d allocations", steps, 2 * ROUNDS);
+    check(steps < ROUNDS / 10, "thread cache hits for alternating 64 and 1024 byte blocks", detail);
+
+    mm_destroy();
+}
+
+static long long total_calls()
+{
+    struct mm_stats stats;
+    mm_get_stats(&stats);
+    long long calls = 0;
+    for (int i = 0; i < MM_TRACE_OPS; i++)
+    {
+        calls += stats.calls[i];
+    }
+    return calls;
+}
+
+/**
+ * @brief A pool slab, with thread caches on, takes exactly one slab from the
+ *        heap, gives it back on destroy and is not counted as a user call
+ */
+static void check_pool_slab_bypasses_cache(char *memory)
+{
+    mm_init(memory, HEAP_SIZE);
+    mm_set_thread_cache_limit(64 << 10);
+
+    int remaining = get_remaining_space();
+    long long calls = total_calls();
+    mm_pool_t *pool = mm_pool_create(24, 100);
+    int slab_bytes = remaining - get_remaining_space();
+    long long slab_calls = total_calls() - calls;
+    mm_pool_destroy(pool);
+    int left_bytes = remaining - get_remaining_space();
+
+    // Unused pool objects count as free space, so only the slab header shows up,
+    // while every extra slab pulled into a thread cache would add 100 objects of 32 bytes
+    char detail[96];
+    snprintf(detail, sizeof(detail), "slab took %d bytes, %d left after destroy, %lld calls recorded", slab_bytes,
+             left_bytes, slab_calls);
+    check(pool != NULL && slab_bytes > 0 && slab_bytes < 100 * 32 && left_bytes == 0 && slab_calls == 0,
+          "pool slab taken and returned outside the thread cache", detail);
+
+    mm_destroy();
+}
+
+// mm_walk callback keeping the largest free block in *arg
+static int largest_free_block(void *start, int size, int allocated, void *arg)
+{
+    (void)start;
+    int *largest = arg;
+    if (!allocated && size > *largest)
+    {
+        *largest = size;
+    }
+    return 0;
+}
+
+/**
+ * @brief The largest free block reported by mm_get_stats, published without
+ *        taking the arena locks, matches a walk of the blocks
+ */
+static void check_largest_free_matches_walk(char *memory)
+{
+    mm_init(memory, HEAP_SIZE);
+
+    void *blocks[64];
+    for (int i = 0; i < 64; i++)
+    {
+        blocks[i] = mymalloc_ff(64 + 128 * i);
+    }
+    // Free every other block so the free space is split into holes of growing size
+    for (int i = 0; i < 64; i += 2)
+    {
+        myfree(blocks[i]);
+    }
+
+    int walked = 0;
+    mm_walk(largest_free_block, &walked);
+    struct mm_stats stats;
+    mm_get_stats(&stats);
+
+    char detail[64];
+    snprintf(detail, sizeof(detail), "stats report %d, walk found %d", stats.largest_free, walked);
+    check(walked > 0 && stats.largest_free == walked, "largest free block matches the heap walk", detail);
+
+    mm_destroy();
+}
+
+/**
+ * @brief What a walk of the heap found
+ * @property free_bytes - bytes in free blocks
+ * @property empty_blocks - number of blocks of 0 bytes
+ */
+struct walk_summary
+{
+    int free_bytes;
+    int empty_blocks;
+};
+
+// mm_walk callback adding every block to the walk_summary in *arg
+static int summarize_block(void *start, int size, int allocated, void *arg)
+{
+    (void)start;
+    struct walk_summary *summary = arg;
+    if (!allocated)
+    {
+        summary->free_bytes += size;
+    }
+    if (size == 0)
+    {
+        summary->empty_blocks++;
+    }
+    return 0;
+}
+
+/**
+ * @brief A handle block whose only free space in front is alignment slack
+ *        stays where it is, compaction must not "move" it by 0 bytes
+ */
+static void check_compact_skips_slack_hole(char *memory)
+{
+    mm_init(memory, HEAP_SIZE);
+
+    // The 10 byte block leaves 6 bytes of slack in front of the aligned handle block
+    mymalloc_ff(10);
+    mm_handle_t *handle = mm_handle_alloc(16);
+    mymalloc_ff(16);
+    int fragments = get_fragment_count();
+    struct mm_stats before;
+    mm_get_stats(&before);
+
+    mm_compact(0);
+    mm_compact(0);
+
+    struct mm_stats after;
+    mm_get_stats(&after);
+    struct walk_summary summary = {0, 0};
+    mm_walk(summarize_block, &summary);
+
+    char detail[96];
+    snprintf(detail, sizeof(detail), "%lld relocations, %d empty blocks, %d fragments before and %d after",
+             after.relocations - before.relocations, summary.empty_blocks, fragments, get_fragment_count());
+    check(handle != NULL && after.relocations == before.relocations && summary.empty_blocks == 0 &&
+              get_fragment_count() == fragments,
+          "compaction leaves a block behind pure alignment slack alone", detail);
+
+    mm_destroy();
+}
+
+#define HANDLES 256
+
+/**
+ * @brief Compaction in small steps moves live handle blocks without changing
+ *        their contents, and gathers the free space into a larger block
+ */
+static void check_compact_keeps_handle_contents(char *memory)
+{
+    mm_init(memory, HEAP_SIZE);
+
+    mm_handle_t *handles[HANDLES];
+    for (int i = 0; i < HANDLES; i++)
+    {
+        handles[i] = mm_handle_alloc(40 + 24 * (i % 7));
+        unsigned char *data = mm_pin(handles[i]);
+        for (int j = 0; j < mm_handle_size(handles[i]); j++)
+        {
+            data[j] = (unsigned char)(i * 31 + j);
+        }
+        mm_unpin(handles[i]);
+    }
+    // Fill all but a little of the heap past the handles, so the free tail stays
+    // smaller than the space the holes gather into
+    mymalloc_ff(get_remaining_space() - 4096);
+    for (int i = 0; i < HANDLES; i += 2)
+    {
+        mm_handle_free(handles[i]);
+        handles[i] = NULL;
+    }
+
+    struct mm_stats before;
+    mm_get_stats(&before);
+    int passes = 1;
+    while (mm_compact(1) == 0)
+    {
+        passes++;
+    }
+    struct mm_stats after;
+    mm_get_stats(&after);
+
+    int damaged = 0;
+    for (int i = 1; i < HANDLES; i += 2)
+    {
+        unsigned char *data = mm_pin(handles[i]);
+        for (int j = 0; j < mm_handle_size(handles[i]); j++)
+        {
+            if (data[j] != (unsigned char)(i * 31 + j))
+            {
+                damaged++;
+                break;
+            }
+        }
+        mm_unpin(handles[i]);
+    }
+    struct walk_summary summary = {0, 0};
+    mm_walk(summarize_block, &summary);
+
+    char detail[160];
+    snprintf(detail, sizeof(detail),
+             "%d damaged handles after %d passes, largest free %d -> %d, walk free %d, remaining %d",
+             damaged, passes, before.largest_free, after.largest_free, summary.free_bytes, get_remaining_space());
+    check(damaged == 0 && after.relocations > before.relocations && after.largest_free > before.largest_free &&
+              summary.free_bytes == get_remaining_space() && summary.empty_blocks == 0,
+          "compaction keeps handle contents and gathers the free space", detail);
+
+    mm_destroy();
+}
+
+/**
+ * @brief Program entry procedure - runs every check
+ * @return 0 if every check passed, 1 otherwise
+ */
+int main()
+{
+    char *memory = malloc(HEAP_SIZE);
+    if (memory == NULL)
+    {
+        printf("could not allocate the test heap\n");
+        return 1;
+    }
+
+    check_thread_cache_size_classes(memory);
+    check_pool_slab_bypasses_cache(memory);
+    check_largest_free_matches_walk(memory);
+    check_compact_skips_slack_hole(memory);
+    check_compact_keeps_handle_contents(memory);
+
+    free(memory);
+    return failures == 0 ? 0 : 1;
+}